@@ -0,0 +1,167 @@
+#include "allocation_stats.h"
+
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+namespace allocation_stats
+{
+    // one cache line per stage so threads in different stages don't contend
+    struct alignas(64) StageCounters
+    {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> bytes;
+    };
+    
+    const char* kStageNames[] =
+    {
+        "other",
+        "frontend",
+        "cross-compile",
+        "output"
+    };
+    
+    std::atomic<bool> g_Enabled(false);
+    StageCounters g_Counters[STAGE_COUNT];
+    thread_local Stage t_Stage = STAGE_OTHER;
+    
+    void record(size_t size)
+    {
+        if (!g_Enabled.load(std::memory_order_relaxed))
+            return;
+        
+        StageCounters& counters = g_Counters[t_Stage];
+        counters.count.fetch_add(1, std::memory_order_relaxed);
+        counters.bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    
+    void set_enabled(bool enabled)
+    {
+        g_Enabled = enabled;
+    }
+    
+    Stage set_stage(Stage stage)
+    {
+        Stage previous = t_Stage;
+        t_Stage = stage;
+        return previous;
+    }
+    
+    void get_stats(StageAllocations (&stats)[STAGE_COUNT])
+    {
+        for (int i = 0; i < STAGE_COUNT; i++)
+        {
+            stats[i].count = g_Counters[i].count.load(std::memory_order_relaxed);
+            stats[i].bytes = g_Counters[i].bytes.load(std::memory_order_relaxed);
+        }
+    }
+    
+    void reset_stats()
+    {
+        for (StageCounters& counters : g_Counters)
+        {
+            counters.count = 0;
+            counters.bytes = 0;
+        }
+    }
+    
+    const char* stage_name(Stage stage)
+    {
+        return kStageNames[stage];
+    }
+}
+
+//
+// Replacements for the global allocation functions. Nothrow new forwards to these by default.
+// The sized and aligned forms are replaced as well, since the library defaults of some of them
+// don't forward here and would pair the replaced new with the library's delete.
+//
+
+void* operator new(size_t size)
+{
+    allocation_stats::record(size);
+    
+    void* memory = malloc(size ? size : 1);
+    
+    if (!memory)
+        throw std::bad_alloc();
+    
+    return memory;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+    free(memory);
+}
+
+#ifdef __cpp_aligned_new
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    allocation_stats::record(size);
+    
+    // aligned_alloc needs a size that is a multiple of the alignment
+    size_t align = std::max(size_t(alignment), sizeof(void*));
+    size_t rounded = (std::max<size_t>(size, 1) + align - 1) / align * align;
+    
+#ifdef _WIN32
+    void* memory = _aligned_malloc(rounded, align);
+#else
+    void* memory = aligned_alloc(align, rounded);
+#endif
+    
+    if (!memory)
+        throw std::bad_alloc();
+    
+    return memory;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept
+{
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+void operator delete[](void* memory, std::align_val_t alignment) noexcept
+{
+    operator delete(memory, alignment);
+}
+
+void operator delete(void* memory, size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(memory, alignment);
+}
+
+void operator delete[](void* memory, size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(memory, alignment);
+}
+#endif
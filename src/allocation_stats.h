@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace allocation_stats
+{
+    enum Stage
+    {
+        STAGE_OTHER,
+        STAGE_FRONTEND,       // glslang preprocessing, parsing, linking and SPIR-V generation
+        STAGE_CROSS_COMPILE,  // SPIRV-Cross compilation and reflection
+        STAGE_OUTPUT,         // minification and writing the outputs
+        STAGE_COUNT
+    };
+    
+    struct StageAllocations
+    {
+        uint64_t count;
+        uint64_t bytes;  // bytes requested, frees aren't subtracted
+    };
+    
+    // Every operator new in the process is counted against the stage the calling thread is
+    // in. Counting is off until enabled, so allocations only cost a flag check by default.
+    extern void set_enabled(bool enabled);
+    
+    // Sets the stage of the calling thread and returns the previous one.
+    extern Stage set_stage(Stage stage);
+    
+    extern void get_stats(StageAllocations (&stats)[STAGE_COUNT]);
+    extern void reset_stats();
+    extern const char* stage_name(Stage stage);
+    
+    // Counts the allocations of the enclosing scope against 'stage'.
+    struct ScopedStage
+    {
+        explicit ScopedStage(Stage stage) : previous(set_stage(stage)) {}
+        ~ScopedStage() { set_stage(previous); }
+        
+        ScopedStage(const ScopedStage&) = delete;
+        ScopedStage& operator=(const ScopedStage&) = delete;
+        
+        Stage previous;
+    };
+}
@@ -0,0 +1,246 @@
+#include "compile_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace compile_queue
+{
+    struct Job
+    {
+        JobHandle handle;
+        CompileRequest request;
+        CompileCallback callback;
+        std::promise<CompileResult> promise;
+        std::atomic<bool> cancelled { false };
+    };
+    
+    // higher priority first, then submission order
+    typedef std::pair<int, JobHandle> QueueKey;
+    
+    std::mutex g_QueueMutex;
+    std::condition_variable g_QueueCondition;
+    std::map<QueueKey, std::shared_ptr<Job>> g_Queue;
+    std::unordered_map<JobHandle, std::shared_ptr<Job>> g_Jobs;  // queued and running jobs
+    std::unordered_map<std::string, std::vector<JobHandle>> g_MaterialJobs;
+    std::vector<std::thread> g_Workers;
+    JobHandle g_NextHandle = 1;
+    bool g_Running = false;
+    
+    QueueKey queue_key(const Job& job)
+    {
+        return QueueKey(-int(job.request.priority), job.handle);
+    }
+    
+    // Must be called with g_QueueMutex held.
+    void forget_job(const Job& job)
+    {
+        g_Jobs.erase(job.handle);
+        
+        if (job.request.material.empty())
+            return;
+        
+        auto material = g_MaterialJobs.find(job.request.material);
+        
+        if (material == g_MaterialJobs.end())
+            return;
+        
+        std::vector<JobHandle>& handles = material->second;
+        handles.erase(std::remove(handles.begin(), handles.end(), job.handle), handles.end());
+        
+        if (handles.empty())
+            g_MaterialJobs.erase(material);
+    }
+    
+    void finish_job(Job& job, CompileResult& result)
+    {
+        {
+            std::lock_guard<std::mutex> lock(g_QueueMutex);
+            forget_job(job);
+        }
+        
+        if (job.callback)
+            job.callback(job.handle, result);
+        
+        job.promise.set_value(std::move(result));
+    }
+    
+    void cancel_job(Job& job)
+    {
+        CompileResult result;
+        result.status = JOB_STATUS_CANCELLED;
+        
+        if (job.callback)
+            job.callback(job.handle, result);
+        
+        job.promise.set_value(std::move(result));
+    }
+    
+    void run_job(Job& job)
+    {
+        const CompileRequest& request = job.request;
+        CompileResult result;
+        result.status = JOB_STATUS_CANCELLED;
+        
+        if (!job.cancelled)
+            result.status = spirv_compiler::compile(request.path, request.stage, result.spirv, request.vulkan_glsl, request.options.native_16bit_types, request.defines) ? JOB_STATUS_SUCCEEDED : JOB_STATUS_FAILED;
+        
+        if (result.status == JOB_STATUS_SUCCEEDED)
+        {
+            if (job.cancelled)
+                result.status = JOB_STATUS_CANCELLED;
+            else if (!cross_compiler::compile(result.spirv, request.lang, result.source, request.options))
+                result.status = JOB_STATUS_FAILED;
+        }
+        
+        finish_job(job, result);
+    }
+    
+    void worker_main()
+    {
+        while (true)
+        {
+            std::shared_ptr<Job> job;
+            
+            {
+                std::unique_lock<std::mutex> lock(g_QueueMutex);
+                g_QueueCondition.wait(lock, []() { return !g_Running || !g_Queue.empty(); });
+                
+                if (!g_Running)
+                    return;
+                
+                job = g_Queue.begin()->second;
+                g_Queue.erase(g_Queue.begin());
+            }
+            
+            run_job(*job);
+        }
+    }
+    
+    bool start(uint32_t worker_count)
+    {
+        std::lock_guard<std::mutex> lock(g_QueueMutex);
+        
+        if (g_Running || worker_count == 0)
+            return false;
+        
+        g_Running = true;
+        
+        for (uint32_t i = 0; i < worker_count; i++)
+            g_Workers.push_back(std::thread(worker_main));
+        
+        return true;
+    }
+    
+    void stop()
+    {
+        std::vector<std::shared_ptr<Job>> queued;
+        
+        {
+            std::lock_guard<std::mutex> lock(g_QueueMutex);
+            
+            g_Running = false;
+            
+            for (auto& entry : g_Queue)
+            {
+                forget_job(*entry.second);
+                queued.push_back(entry.second);
+            }
+            
+            g_Queue.clear();
+        }
+        
+        g_QueueCondition.notify_all();
+        
+        for (std::thread& worker : g_Workers)
+            worker.join();
+        
+        g_Workers.clear();
+        
+        for (auto& job : queued)
+            cancel_job(*job);
+    }
+    
+    JobHandle submit(const CompileRequest& request, std::future<CompileResult>& result, CompileCallback callback)
+    {
+        std::shared_ptr<Job> job = std::make_shared<Job>();
+        job->request = request;
+        job->callback = callback;
+        result = job->promise.get_future();
+        
+        std::vector<std::shared_ptr<Job>> superseded;
+        
+        {
+            std::lock_guard<std::mutex> lock(g_QueueMutex);
+            
+            job->handle = g_NextHandle++;
+            
+            // nothing will run the job once the queue is stopped
+            if (!g_Running)
+                superseded.push_back(job);
+            else
+            {
+                if (!request.material.empty())
+                {
+                    std::vector<JobHandle>& handles = g_MaterialJobs[request.material];
+                    
+                    // queued jobs are dropped now, running ones stop at their next step
+                    for (JobHandle handle : handles)
+                    {
+                        std::shared_ptr<Job>& previous = g_Jobs[handle];
+                        previous->cancelled = true;
+                        
+                        if (g_Queue.erase(queue_key(*previous)) > 0)
+                            superseded.push_back(previous);
+                    }
+                    
+                    for (auto& previous : superseded)
+                        forget_job(*previous);
+                    
+                    g_MaterialJobs[request.material].push_back(job->handle);
+                }
+                
+                g_Jobs[job->handle] = job;
+                g_Queue[queue_key(*job)] = job;
+            }
+        }
+        
+        for (auto& previous : superseded)
+            cancel_job(*previous);
+        
+        g_QueueCondition.notify_one();
+        
+        return job->handle;
+    }
+    
+    bool cancel(JobHandle handle)
+    {
+        std::shared_ptr<Job> job;
+        
+        {
+            std::lock_guard<std::mutex> lock(g_QueueMutex);
+            
+            auto it = g_Jobs.find(handle);
+            
+            if (it == g_Jobs.end())
+                return false;
+            
+            it->second->cancelled = true;
+            
+            if (g_Queue.erase(queue_key(*it->second)) == 0)
+                return true;
+            
+            job = it->second;
+            forget_job(*job);
+        }
+        
+        cancel_job(*job);
+        
+        return true;
+    }
+}
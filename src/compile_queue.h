@@ -0,0 +1,65 @@
+#pragma once
+
+#include "spirv_compiler.h"
+#include "cross_compiler.h"
+
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace compile_queue
+{
+    enum Priority
+    {
+        PRIORITY_BACKGROUND,
+        PRIORITY_NORMAL,
+        PRIORITY_INTERACTIVE
+    };
+    
+    enum JobStatus
+    {
+        JOB_STATUS_SUCCEEDED,
+        JOB_STATUS_FAILED,
+        JOB_STATUS_CANCELLED
+    };
+    
+    struct CompileRequest
+    {
+        std::string path;
+        spirv_compiler::ShaderStage stage;
+        cross_compiler::ShadingLanguage lang;
+        cross_compiler::CompileOptions options;  // 'binding_remap' must outlive the job
+        bool vulkan_glsl = false;
+        std::vector<std::string> defines;  // "NAME" or "NAME=VALUE"
+        // Jobs with the same non-empty key supersede each other: submitting one cancels the
+        // jobs for that key which haven't finished yet.
+        std::string material;
+        Priority priority = PRIORITY_NORMAL;
+    };
+    
+    struct CompileResult
+    {
+        JobStatus status;
+        std::vector<unsigned int> spirv;
+        std::string source;
+    };
+    
+    typedef uint64_t JobHandle;
+    typedef std::function<void(JobHandle, const CompileResult&)> CompileCallback;
+    
+    // Starts the worker threads, which compile and cross-compile their jobs in parallel.
+    extern bool start(uint32_t worker_count = 1);
+    
+    // Cancels the queued jobs and waits for the running ones to finish.
+    extern void stop();
+    
+    // Queues a job. Jobs run in priority order, oldest first within a priority. The callback,
+    // if any, is called on the worker thread before the future is made ready.
+    extern JobHandle submit(const CompileRequest& request, std::future<CompileResult>& result, CompileCallback callback = nullptr);
+    
+    // Cancels a job. Queued jobs are dropped right away, running jobs are stopped before their
+    // next compile step. Returns false if the job has already finished.
+    extern bool cancel(JobHandle handle);
+}
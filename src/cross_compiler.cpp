@@ -1,4 +1,6 @@
 #include "cross_compiler.h"
+#include "spirv_transform.h"
+#include "allocation_stats.h"
 
 #include <spirv_glsl.hpp>
 #include <spirv_hlsl.hpp>
@@ -6,6 +8,14 @@
 
 #include <locale>
 #include <iostream>
+#include <algorithm>
+#include <map>
+#include <array>
+#include <set>
+#include <unordered_set>
+#include <cstring>
+#include <cctype>
+#include <initializer_list>
 
 namespace cross_compiler
 {
@@ -92,8 +102,1305 @@ namespace cross_compiler
         }
     }
 
+    spirv_cross::ShaderResources shader_resources(spirv_cross::Compiler& compiler, const CompileOptions& compile_options)
+    {
+        if (!compile_options.strip_unused_resources)
+            return compiler.get_shader_resources();
+        
+        /* only declare the resources and interface variables that are
+         statically accessed by the entry point, everything pulled in
+         through shared includes but never touched is dropped
+         */
+        auto active = compiler.get_active_interface_variables();
+        spirv_cross::ShaderResources resources = compiler.get_shader_resources(active);
+        compiler.set_enabled_interface_variables(std::move(active));
+        
+        return resources;
+    }
+    
+    void find_unused_block_members(const spirv_cross::Compiler& compiler, const spirv_cross::ShaderResources& resources, std::vector<BlockMember>& unused_members)
+    {
+        for (const spirv_cross::Resource& ubo : resources.uniform_buffers)
+        {
+            const spirv_cross::SPIRType& type = compiler.get_type(ubo.base_type_id);
+            auto ranges = compiler.get_active_buffer_ranges(ubo.id);
+            
+            // a block with no ranges is either unused or accessed as a whole
+            if (ranges.empty())
+                continue;
+            
+            std::vector<bool> used(type.member_types.size(), false);
+            
+            for (const spirv_cross::BufferRange& range : ranges)
+                used[range.index] = true;
+            
+            for (uint32_t i = 0; i < type.member_types.size(); i++)
+            {
+                if (used[i])
+                    continue;
+                
+                BlockMember member;
+                
+                member.block = compiler.get_name(ubo.base_type_id);
+                member.name = compiler.get_member_name(ubo.base_type_id, i);
+                member.index = i;
+                member.offset = compiler.type_struct_member_offset(type, i);
+                member.size = (uint32_t)compiler.get_declared_struct_member_size(type, i);
+                
+                unused_members.push_back(member);
+            }
+        }
+    }
+    
+    bool strip_unused_block_members(std::vector<unsigned int>& spirv)
+    {
+        /* members can only be removed from the end of a block, removing
+         one in the middle would shift the std140 layout of the rest
+         */
+        std::unordered_map<uint32_t, uint32_t> member_counts;
+        
+        {
+            spirv_cross::Compiler compiler(spirv);
+            spirv_cross::ShaderResources resources = compiler.get_shader_resources(compiler.get_active_interface_variables());
+            
+            for (const spirv_cross::Resource& ubo : resources.uniform_buffers)
+            {
+                auto ranges = compiler.get_active_buffer_ranges(ubo.id);
+                
+                if (ranges.empty())
+                    continue;
+                
+                uint32_t count = 0;
+                
+                for (const spirv_cross::BufferRange& range : ranges)
+                    count = std::max(count, (uint32_t)range.index + 1);
+                
+                uint32_t& block_count = member_counts[ubo.base_type_id];
+                block_count = std::max(block_count, count);
+            }
+        }
+        
+        for (auto& block : member_counts)
+        {
+            if (!spirv_transform::trim_struct_members(spirv, block.first, block.second))
+                return false;
+        }
+        
+        return true;
+    }
+    
+    bool is_flattenable_block(const spirv_cross::Compiler& compiler, const spirv_cross::SPIRType& type)
+    {
+        for (uint32_t i = 0; i < type.member_types.size(); i++)
+        {
+            const spirv_cross::SPIRType& member_type = compiler.get_type(type.member_types[i]);
+            
+            if (member_type.basetype == spirv_cross::SPIRType::Struct)
+            {
+                if (!is_flattenable_block(compiler, member_type))
+                    return false;
+            }
+            else if (member_type.basetype != spirv_cross::SPIRType::Float)
+                return false;
+        }
+        
+        return true;
+    }
+    
+    void flatten_uniform_blocks(spirv_cross::CompilerGLSL& glsl, const spirv_cross::ShaderResources& resources)
+    {
+        /* emit each uniform block as a single vec4 array so the runtime
+         can upload the whole block with one glUniform4fv call
+         */
+        for (const spirv_cross::Resource& ubo : resources.uniform_buffers)
+        {
+            if (is_flattenable_block(glsl, glsl.get_type(ubo.base_type_id)))
+                glsl.flatten_buffer_block(ubo.id);
+            else
+                printf("Uniform block %s has non-float members and will not be flattened\n", glsl.get_name(ubo.base_type_id).c_str());
+        }
+    }
+    
+    void reflect_flattened_blocks(const spirv_cross::Compiler& compiler, const spirv_cross::ShaderResources& resources, std::vector<FlattenedUniformBlock>& blocks)
+    {
+        for (const spirv_cross::Resource& ubo : resources.uniform_buffers)
+        {
+            const spirv_cross::SPIRType& type = compiler.get_type(ubo.base_type_id);
+            
+            if (!is_flattenable_block(compiler, type))
+                continue;
+            
+            FlattenedUniformBlock block;
+            
+            block.name = compiler.get_name(ubo.base_type_id);
+            block.vec4_count = uint32_t((compiler.get_declared_struct_size(type) + 15) / 16);
+            
+            for (uint32_t i = 0; i < type.member_types.size(); i++)
+            {
+                const spirv_cross::SPIRType& member_type = compiler.get_type(type.member_types[i]);
+                uint32_t offset = compiler.type_struct_member_offset(type, i);
+                
+                FlattenedMember member;
+                
+                member.name = compiler.get_member_name(ubo.base_type_id, i);
+                member.type = g_TypeTableStr[member_type.basetype];
+                member.vec4_offset = offset / 16;
+                member.component = (offset % 16) / 4;
+                member.array_size = member_type.array.size() > 0 ? member_type.array[0] : 1;
+                
+                block.members.push_back(member);
+            }
+            
+            blocks.push_back(block);
+        }
+    }
+    
+    void apply_precision_options(spirv_cross::CompilerGLSL& glsl, spirv_cross::CompilerGLSL::Options& options, const CompileOptions& compile_options)
+    {
+        const spirv_cross::CompilerGLSL::Options::Precision kPrecisions[] =
+        {
+            spirv_cross::CompilerGLSL::Options::DontCare,
+            spirv_cross::CompilerGLSL::Options::Lowp,
+            spirv_cross::CompilerGLSL::Options::Mediump,
+            spirv_cross::CompilerGLSL::Options::Highp
+        };
+        
+        const char* kPrecisionQualifiers[] = { "", "lowp", "mediump", "highp" };
+        
+        if (compile_options.fragment_precision != PRECISION_DEFAULT)
+            options.fragment.default_float_precision = kPrecisions[compile_options.fragment_precision];
+        
+        /* SPIRV-Cross only emits default precision statements for fragment
+         shaders, vertex shaders are implicitly highp so anything else has
+         to be declared explicitly
+         */
+        if (glsl.get_execution_model() == spv::ExecutionModelVertex &&
+            compile_options.vertex_precision != PRECISION_DEFAULT &&
+            compile_options.vertex_precision != PRECISION_HIGHP)
+        {
+            glsl.add_header_line(std::string("precision ") + kPrecisionQualifiers[compile_options.vertex_precision] + " float;");
+            glsl.add_header_line(std::string("precision ") + kPrecisionQualifiers[compile_options.vertex_precision] + " int;");
+        }
+    }
+    
+    bool uses_16bit_storage(const spirv_cross::Compiler& compiler)
+    {
+        for (spv::Capability capability : compiler.get_declared_capabilities())
+        {
+            if (capability == spv::CapabilityStorageUniformBufferBlock16 ||
+                capability == spv::CapabilityStorageUniform16 ||
+                capability == spv::CapabilityStoragePushConstant16 ||
+                capability == spv::CapabilityStorageInputOutput16)
+                return true;
+        }
+        
+        return false;
+    }
+    
+    struct DescriptorResource
+    {
+        uint32_t id;
+        uint32_t base_type_id;
+        DescriptorType type;
+        bool combined;  // combined image sampler, occupies both a texture and a sampler slot
+        uint32_t set;
+        uint32_t binding;
+        uint32_t array_size;  // consecutive slots taken by descriptor arrays
+        std::string name;
+    };
+    
+    // Number of descriptors in an array of resources, 1 for non-arrays. Runtime and
+    // specialization constant sized arrays count as a single descriptor.
+    uint32_t descriptor_array_size(const spirv_cross::SPIRType& type)
+    {
+        uint32_t size = 1;
+        
+        for (size_t i = 0; i < type.array.size(); i++)
+        {
+            if (type.array_size_literal[i] && type.array[i] > 0)
+                size *= type.array[i];
+        }
+        
+        return size;
+    }
+    
+    // Gathers every descriptor backed resource sorted by set and binding.
+    void collect_descriptor_resources(const spirv_cross::Compiler& compiler, const spirv_cross::ShaderResources& resources, std::vector<DescriptorResource>& descriptors)
+    {
+        auto add = [&compiler, &descriptors](const spirv_cross::SmallVector<spirv_cross::Resource>& list, DescriptorType type, bool combined)
+        {
+            for (const spirv_cross::Resource& resource : list)
+            {
+                DescriptorResource desc;
+                
+                desc.id = resource.id;
+                desc.base_type_id = resource.base_type_id;
+                desc.type = type;
+                desc.combined = combined;
+                desc.set = compiler.get_decoration(resource.id, spv::DecorationDescriptorSet);
+                desc.binding = compiler.get_decoration(resource.id, spv::DecorationBinding);
+                desc.array_size = descriptor_array_size(compiler.get_type(resource.type_id));
+                desc.name = resource.name;
+                
+                descriptors.push_back(desc);
+            }
+        };
+        
+        add(resources.uniform_buffers, DESCRIPTOR_TYPE_UBO, false);
+        add(resources.storage_buffers, DESCRIPTOR_TYPE_SSBO, false);
+        add(resources.sampled_images, DESCRIPTOR_TYPE_TEXTURE, true);
+        add(resources.separate_images, DESCRIPTOR_TYPE_TEXTURE, false);
+        add(resources.separate_samplers, DESCRIPTOR_TYPE_SAMPLER, false);
+        add(resources.storage_images, DESCRIPTOR_TYPE_IMAGE, false);
+        
+        std::stable_sort(descriptors.begin(), descriptors.end(), [](const DescriptorResource& a, const DescriptorResource& b)
+                         {
+                             if (a.set != b.set)
+                                 return a.set < b.set;
+                             return a.binding < b.binding;
+                         });
+    }
+    
+    void build_argument_buffer_layout(const spirv_cross::Compiler& compiler, const spirv_cross::ShaderResources& resources, uint32_t tier, ArgumentBufferLayout& layout)
+    {
+        std::vector<DescriptorResource> descriptors;
+        collect_descriptor_resources(compiler, resources, descriptors);
+        
+        std::map<uint32_t, bool> sets;  // set -> has writable textures
+        
+        for (const DescriptorResource& desc : descriptors)
+            sets[desc.set] = sets[desc.set] || desc.type == DESCRIPTOR_TYPE_IMAGE;
+        
+        for (auto& set : sets)
+        {
+            // tier 1 argument buffers can't hold writable textures
+            if (tier < 2 && set.second)
+                layout.discrete_sets.push_back(set.first);
+            else
+                layout.argument_buffer_sets.push_back(set.first);
+        }
+        
+        /* argument buffer members share one [[id(n)]] space per set. Discrete
+         sets are bound straight to the function, so they share one buffer,
+         texture and sampler counter across all of them, and their buffers
+         start after the [[buffer(n)]] slots the argument buffers (one per
+         set index) take
+         */
+        std::map<uint32_t, uint32_t> argument_buffer_ids;
+        std::array<uint32_t, 3> discrete_counters = { 0, 0, 0 };
+        
+        if (!layout.argument_buffer_sets.empty())
+            discrete_counters[0] = layout.argument_buffer_sets.back() + 1;
+        
+        for (const DescriptorResource& desc : descriptors)
+        {
+            bool discrete = std::find(layout.discrete_sets.begin(), layout.discrete_sets.end(), desc.set) != layout.discrete_sets.end();
+            
+            uint32_t kind = 0;
+            
+            if (desc.type == DESCRIPTOR_TYPE_TEXTURE || desc.type == DESCRIPTOR_TYPE_IMAGE)
+                kind = 1;
+            else if (desc.type == DESCRIPTOR_TYPE_SAMPLER)
+                kind = 2;
+            
+            // hands out one index per array element and returns the first
+            auto allocate = [&](uint32_t resource_kind)
+            {
+                uint32_t& counter = discrete ? discrete_counters[resource_kind] : argument_buffer_ids[desc.set];
+                uint32_t index = counter;
+                counter += desc.array_size;
+                return index;
+            };
+            
+            ArgumentBufferResource resource;
+            
+            resource.type = desc.type;
+            resource.set = desc.set;
+            resource.binding = desc.binding;
+            resource.index = allocate(kind);
+            resource.name = desc.name;
+            
+            layout.resources.push_back(resource);
+            
+            if (desc.combined)
+            {
+                resource.type = DESCRIPTOR_TYPE_SAMPLER;
+                resource.index = allocate(2);
+                resource.name = desc.name + "Smplr";
+                
+                layout.resources.push_back(resource);
+            }
+        }
+    }
+    
+    void apply_argument_buffer_layout(spirv_cross::CompilerMSL& msl, const ArgumentBufferLayout& layout)
+    {
+        for (uint32_t set : layout.discrete_sets)
+            msl.add_discrete_descriptor_set(set);
+        
+        std::map<std::pair<uint32_t, uint32_t>, spirv_cross::MSLResourceBinding> bindings;
+        
+        for (const ArgumentBufferResource& resource : layout.resources)
+        {
+            spirv_cross::MSLResourceBinding& binding = bindings[std::make_pair(resource.set, resource.binding)];
+            
+            binding.stage = msl.get_execution_model();
+            binding.desc_set = resource.set;
+            binding.binding = resource.binding;
+            
+            if (resource.type == DESCRIPTOR_TYPE_UBO || resource.type == DESCRIPTOR_TYPE_SSBO)
+                binding.msl_buffer = resource.index;
+            else if (resource.type == DESCRIPTOR_TYPE_SAMPLER)
+                binding.msl_sampler = resource.index;
+            else
+                binding.msl_texture = resource.index;
+        }
+        
+        for (auto& binding : bindings)
+            msl.add_msl_resource_binding(binding.second);
+    }
+    
+    bool generate_argument_buffer_layout(const std::vector<unsigned int>& spirv, const CompileOptions& compile_options, ArgumentBufferLayout& layout)
+    {
+        if (spirv.size() == 0)
+        {
+            printf("No valid SPIR-V bytecode provided!");
+            return false;
+        }
+        
+        spirv_cross::Compiler compiler(spirv);
+        spirv_cross::ShaderResources resources = shader_resources(compiler, compile_options);
+        
+        build_argument_buffer_layout(compiler, resources, compile_options.msl_argument_buffer_tier, layout);
+        
+        return true;
+    }
+    
+    // Push constants are bound to the last of the 14 constant buffer registers so they
+    // never collide with the registers derived from uniform block bindings.
+    const uint32_t kPushConstantRegister = 13;
+    
+    // Largest uniform block, in bytes, that is placed directly in the root signature.
+    const uint32_t kMaxRootConstantBlockSize = 64;
+    
+    // D3D12 limit on the size of a root signature.
+    const uint32_t kMaxRootSignatureDWords = 64;
+    
+    void set_push_constant_root_layout(spirv_cross::CompilerHLSL& hlsl, const spirv_cross::ShaderResources& resources)
+    {
+        std::vector<spirv_cross::RootConstants> layouts;
+        
+        for (const spirv_cross::Resource& resource : resources.push_constant_buffers)
+        {
+            spirv_cross::RootConstants layout;
+            
+            layout.start = 0;
+            layout.end = uint32_t(hlsl.get_declared_struct_size(hlsl.get_type(resource.base_type_id)));
+            layout.binding = kPushConstantRegister;
+            layout.space = 0;
+            
+            layouts.push_back(layout);
+        }
+        
+        if (!layouts.empty())
+            hlsl.set_root_constant_layouts(layouts);
+    }
+    
+    enum HlslRegisterClass
+    {
+        HLSL_REGISTER_B,
+        HLSL_REGISTER_T,
+        HLSL_REGISTER_U,
+        HLSL_REGISTER_S
+    };
+    
+    bool generate_binding_remap(const std::vector<std::vector<unsigned int>>& stages, const CompileOptions& compile_options, BindingRemapTable& table)
+    {
+        std::map<std::pair<uint32_t, uint32_t>, BindingRemap> bindings;
+        std::map<std::pair<uint32_t, uint32_t>, bool> read_only;
+        std::map<std::pair<uint32_t, uint32_t>, uint32_t> array_sizes;
+        
+        for (const std::vector<unsigned int>& spirv : stages)
+        {
+            if (spirv.size() == 0)
+            {
+                printf("No valid SPIR-V bytecode provided!");
+                return false;
+            }
+            
+            spirv_cross::Compiler compiler(spirv);
+            spirv_cross::ShaderResources resources = shader_resources(compiler, compile_options);
+            
+            std::vector<DescriptorResource> descriptors;
+            collect_descriptor_resources(compiler, resources, descriptors);
+            
+            for (const DescriptorResource& desc : descriptors)
+            {
+                auto key = std::make_pair(desc.set, desc.binding);
+                
+                if (bindings.find(key) != bindings.end())
+                    continue;
+                
+                BindingRemap remap;
+                
+                remap.type = desc.type;
+                remap.set = desc.set;
+                remap.binding = desc.binding;
+                remap.name = desc.name;
+                remap.combined = desc.combined;
+                remap.hlsl_register = 0;
+                remap.msl_index = 0;
+                remap.msl_sampler_index = 0;
+                remap.glsl_binding = 0;
+                
+                bindings[key] = remap;
+                read_only[key] = desc.type == DESCRIPTOR_TYPE_SSBO && compiler.get_buffer_block_flags(desc.id).get(spv::DecorationNonWritable);
+                array_sizes[key] = desc.array_size;
+            }
+        }
+        
+        /* indices are handed out in set/binding order over the union of all
+         stages, so every stage of the pipeline agrees on them. Descriptor
+         arrays take one index per element
+         */
+        uint32_t hlsl_counters[4] = { 0, 0, 0, 0 };
+        uint32_t msl_buffers = 0;
+        uint32_t msl_textures = 0;
+        uint32_t msl_samplers = 0;
+        uint32_t glsl_counters[4] = { 0, 0, 0, 0 };
+        std::set<uint32_t> combined_samplers;
+        
+        for (auto& entry : bindings)
+        {
+            BindingRemap& remap = entry.second;
+            uint32_t count = array_sizes[entry.first];
+            
+            // hands out 'count' consecutive indices and returns the first
+            auto allocate = [count](uint32_t& counter)
+            {
+                uint32_t index = counter;
+                counter += count;
+                return index;
+            };
+            
+            switch (remap.type)
+            {
+                case DESCRIPTOR_TYPE_UBO:
+                    remap.hlsl_register = allocate(hlsl_counters[HLSL_REGISTER_B]);
+                    remap.msl_index = allocate(msl_buffers);
+                    remap.glsl_binding = allocate(glsl_counters[0]);
+                    break;
+                case DESCRIPTOR_TYPE_SSBO:
+                    remap.hlsl_register = allocate(hlsl_counters[read_only[entry.first] ? HLSL_REGISTER_T : HLSL_REGISTER_U]);
+                    remap.msl_index = allocate(msl_buffers);
+                    remap.glsl_binding = allocate(glsl_counters[1]);
+                    break;
+                case DESCRIPTOR_TYPE_TEXTURE:
+                    remap.hlsl_register = allocate(hlsl_counters[HLSL_REGISTER_T]);
+                    remap.msl_index = allocate(msl_textures);
+                    remap.glsl_binding = allocate(glsl_counters[2]);
+                    
+                    // the HLSL SamplerState of a combined image sampler shares the texture's register number
+                    if (remap.combined)
+                    {
+                        remap.msl_sampler_index = allocate(msl_samplers);
+                        
+                        for (uint32_t i = 0; i < count; i++)
+                            combined_samplers.insert(remap.hlsl_register + i);
+                    }
+                    break;
+                case DESCRIPTOR_TYPE_IMAGE:
+                    remap.hlsl_register = allocate(hlsl_counters[HLSL_REGISTER_U]);
+                    remap.msl_index = allocate(msl_textures);
+                    remap.glsl_binding = allocate(glsl_counters[3]);
+                    break;
+                case DESCRIPTOR_TYPE_SAMPLER:
+                    remap.msl_index = allocate(msl_samplers);
+                    break;
+            }
+        }
+        
+        for (auto& entry : bindings)
+        {
+            BindingRemap& remap = entry.second;
+            
+            if (remap.type != DESCRIPTOR_TYPE_SAMPLER)
+                continue;
+            
+            uint32_t count = array_sizes[entry.first];
+            
+            // sampler arrays need a run of registers clear of the combined samplers
+            auto overlaps_combined = [&](uint32_t first)
+            {
+                auto it = combined_samplers.lower_bound(first);
+                return it != combined_samplers.end() && *it < first + count;
+            };
+            
+            while (overlaps_combined(hlsl_counters[HLSL_REGISTER_S]))
+                hlsl_counters[HLSL_REGISTER_S]++;
+            
+            remap.hlsl_register = hlsl_counters[HLSL_REGISTER_S];
+            hlsl_counters[HLSL_REGISTER_S] += count;
+        }
+        
+        table.bindings.clear();
+        
+        for (auto& entry : bindings)
+            table.bindings.push_back(entry.second);
+        
+        return true;
+    }
+    
+    const BindingRemap* find_binding_remap(const BindingRemapTable& table, uint32_t set, uint32_t binding)
+    {
+        for (const BindingRemap& remap : table.bindings)
+        {
+            if (remap.set == set && remap.binding == binding)
+                return &remap;
+        }
+        
+        return nullptr;
+    }
+    
+    // Rewrites the set/binding decorations, which the GLSL and HLSL backends turn into
+    // layout(binding) and register() declarations.
+    void apply_binding_remap(spirv_cross::Compiler& compiler, const spirv_cross::ShaderResources& resources, ShadingLanguage output_lang, const BindingRemapTable& table)
+    {
+        std::vector<DescriptorResource> descriptors;
+        collect_descriptor_resources(compiler, resources, descriptors);
+        
+        for (const DescriptorResource& desc : descriptors)
+        {
+            const BindingRemap* remap = find_binding_remap(table, desc.set, desc.binding);
+            
+            if (!remap)
+                continue;
+            
+            uint32_t binding = output_lang == SHADING_LANGUAGE_HLSL ? remap->hlsl_register : remap->glsl_binding;
+            
+            compiler.set_decoration(desc.id, spv::DecorationDescriptorSet, 0);
+            compiler.set_decoration(desc.id, spv::DecorationBinding, binding);
+        }
+    }
+    
+    void apply_msl_binding_remap(spirv_cross::CompilerMSL& msl, const spirv_cross::ShaderResources& resources, const BindingRemapTable& table)
+    {
+        std::vector<DescriptorResource> descriptors;
+        collect_descriptor_resources(msl, resources, descriptors);
+        
+        for (const DescriptorResource& desc : descriptors)
+        {
+            const BindingRemap* remap = find_binding_remap(table, desc.set, desc.binding);
+            
+            if (!remap)
+                continue;
+            
+            spirv_cross::MSLResourceBinding binding;
+            
+            binding.stage = msl.get_execution_model();
+            binding.desc_set = desc.set;
+            binding.binding = desc.binding;
+            
+            if (remap->type == DESCRIPTOR_TYPE_UBO || remap->type == DESCRIPTOR_TYPE_SSBO)
+                binding.msl_buffer = remap->msl_index;
+            else if (remap->type == DESCRIPTOR_TYPE_SAMPLER)
+                binding.msl_sampler = remap->msl_index;
+            else
+            {
+                binding.msl_texture = remap->msl_index;
+                binding.msl_sampler = remap->msl_sampler_index;
+            }
+            
+            msl.add_msl_resource_binding(binding);
+        }
+    }
+    
+    struct RootBinding
+    {
+        DescriptorRangeType type;
+        uint32_t shader_register;
+        uint32_t space;
+        uint32_t set;
+        uint32_t count;           // registers taken, more than one for descriptor arrays
+        uint32_t size;            // uniform block size in bytes
+        uint32_t visibility_mask; // bit per ShaderVisibility
+        bool push_constant;
+        std::string name;
+    };
+    
+    ShaderVisibility visibility_from_mask(uint32_t mask)
+    {
+        if (mask == (1u << SHADER_VISIBILITY_VERTEX))
+            return SHADER_VISIBILITY_VERTEX;
+        if (mask == (1u << SHADER_VISIBILITY_PIXEL))
+            return SHADER_VISIBILITY_PIXEL;
+        
+        return SHADER_VISIBILITY_ALL;
+    }
+    
+    void add_root_binding(std::vector<RootBinding>& bindings, const RootBinding& binding)
+    {
+        for (RootBinding& existing : bindings)
+        {
+            if (existing.type == binding.type && existing.shader_register == binding.shader_register && existing.space == binding.space)
+            {
+                existing.visibility_mask |= binding.visibility_mask;
+                existing.count = std::max(existing.count, binding.count);
+                existing.size = std::max(existing.size, binding.size);
+                return;
+            }
+        }
+        
+        bindings.push_back(binding);
+    }
+    
+    std::string root_signature_to_hlsl(const RootSignature& root_signature)
+    {
+        const char* kVisibilities[] = { "SHADER_VISIBILITY_ALL", "SHADER_VISIBILITY_VERTEX", "SHADER_VISIBILITY_PIXEL" };
+        const char* kRangeTypes[] = { "SRV", "UAV", "CBV", "Sampler" };
+        const char kRegisterTypes[] = { 't', 'u', 'b', 's' };
+        
+        std::string hlsl;
+        
+        if (root_signature.allow_input_layout)
+            hlsl += "RootFlags(ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT)";
+        
+        for (const RootParameter& param : root_signature.parameters)
+        {
+            if (!hlsl.empty())
+                hlsl += ", ";
+            
+            if (param.type == ROOT_PARAMETER_CONSTANTS)
+                hlsl += "RootConstants(num32BitConstants=" + std::to_string(param.num_constants) + ", b" + std::to_string(param.shader_register) + ", space=" + std::to_string(param.space);
+            else if (param.type == ROOT_PARAMETER_CBV)
+                hlsl += "CBV(b" + std::to_string(param.shader_register) + ", space=" + std::to_string(param.space);
+            else
+            {
+                hlsl += "DescriptorTable(";
+                
+                for (size_t i = 0; i < param.ranges.size(); i++)
+                {
+                    const DescriptorRange& range = param.ranges[i];
+                    
+                    hlsl += std::string(i > 0 ? ", " : "") + kRangeTypes[range.type] + "(" + kRegisterTypes[range.type] + std::to_string(range.base_register) +
+                            ", numDescriptors=" + std::to_string(range.count) + ", space=" + std::to_string(range.space) + ")";
+                }
+            }
+            
+            hlsl += std::string(", visibility=") + kVisibilities[param.visibility] + ")";
+        }
+        
+        return hlsl;
+    }
+    
+    uint32_t root_parameter_cost(const RootParameter& param)
+    {
+        if (param.type == ROOT_PARAMETER_CONSTANTS)
+            return param.num_constants;
+        if (param.type == ROOT_PARAMETER_CBV)
+            return 2;
+        
+        return 1;
+    }
+    
+    bool generate_root_signature(const std::vector<std::vector<unsigned int>>& stages, const CompileOptions& compile_options, RootSignature& root_signature)
+    {
+        // spaces are only emitted for shader model 5.1 and up
+        bool use_spaces = compile_options.native_16bit_types;
+        
+        std::vector<RootBinding> bindings;
+        
+        root_signature.allow_input_layout = false;
+        root_signature.parameters.clear();
+        
+        for (const std::vector<unsigned int>& spirv : stages)
+        {
+            if (spirv.size() == 0)
+            {
+                printf("No valid SPIR-V bytecode provided!");
+                return false;
+            }
+            
+            spirv_cross::Compiler compiler(spirv);
+            spirv_cross::ShaderResources resources = shader_resources(compiler, compile_options);
+            
+            uint32_t visibility_mask = 1u << SHADER_VISIBILITY_ALL;
+            
+            if (compiler.get_execution_model() == spv::ExecutionModelVertex)
+            {
+                visibility_mask = 1u << SHADER_VISIBILITY_VERTEX;
+                root_signature.allow_input_layout = true;
+            }
+            else if (compiler.get_execution_model() == spv::ExecutionModelFragment)
+                visibility_mask = 1u << SHADER_VISIBILITY_PIXEL;
+            
+            std::vector<DescriptorResource> descriptors;
+            collect_descriptor_resources(compiler, resources, descriptors);
+            
+            for (const DescriptorResource& desc : descriptors)
+            {
+                RootBinding binding;
+                
+                binding.shader_register = desc.binding;
+                binding.space = use_spaces ? desc.set : 0;
+                
+                if (compile_options.binding_remap)
+                {
+                    const BindingRemap* remap = find_binding_remap(*compile_options.binding_remap, desc.set, desc.binding);
+                    
+                    if (remap)
+                    {
+                        binding.shader_register = remap->hlsl_register;
+                        binding.space = 0;
+                    }
+                }
+                binding.set = desc.set;
+                binding.count = desc.array_size;
+                binding.size = 0;
+                binding.visibility_mask = visibility_mask;
+                binding.push_constant = false;
+                binding.name = desc.name;
+                
+                if (desc.type == DESCRIPTOR_TYPE_UBO)
+                {
+                    binding.type = DESCRIPTOR_RANGE_CBV;
+                    binding.size = uint32_t(compiler.get_declared_struct_size(compiler.get_type(desc.base_type_id)));
+                }
+                else if (desc.type == DESCRIPTOR_TYPE_SSBO || desc.type == DESCRIPTOR_TYPE_IMAGE)
+                {
+                    // read-only storage buffers are emitted as ByteAddressBuffer SRVs
+                    bool read_only = desc.type == DESCRIPTOR_TYPE_SSBO && compiler.get_buffer_block_flags(desc.id).get(spv::DecorationNonWritable);
+                    binding.type = read_only ? DESCRIPTOR_RANGE_SRV : DESCRIPTOR_RANGE_UAV;
+                }
+                else if (desc.type == DESCRIPTOR_TYPE_SAMPLER)
+                    binding.type = DESCRIPTOR_RANGE_SAMPLER;
+                else
+                    binding.type = DESCRIPTOR_RANGE_SRV;
+                
+                add_root_binding(bindings, binding);
+                
+                // combined image samplers get a SamplerState at the same register number
+                if (desc.combined)
+                {
+                    binding.type = DESCRIPTOR_RANGE_SAMPLER;
+                    add_root_binding(bindings, binding);
+                }
+            }
+            
+            for (const spirv_cross::Resource& resource : resources.push_constant_buffers)
+            {
+                RootBinding binding;
+                
+                binding.type = DESCRIPTOR_RANGE_CBV;
+                binding.shader_register = kPushConstantRegister;
+                binding.space = 0;
+                binding.set = 0;
+                binding.count = 1;
+                binding.size = uint32_t(compiler.get_declared_struct_size(compiler.get_type(resource.base_type_id)));
+                binding.visibility_mask = visibility_mask;
+                binding.push_constant = true;
+                binding.name = resource.name;
+                
+                add_root_binding(bindings, binding);
+            }
+        }
+        
+        /* small constant blocks go straight into the root signature as root
+         constants, other constant blocks become root CBVs and everything
+         else is grouped into one table per set and visibility (samplers
+         need a table of their own)
+         */
+        std::map<std::pair<uint32_t, uint32_t>, std::vector<const RootBinding*>> tables;
+        std::map<std::pair<uint32_t, uint32_t>, std::vector<const RootBinding*>> sampler_tables;
+        
+        for (const RootBinding& binding : bindings)
+        {
+            ShaderVisibility visibility = visibility_from_mask(binding.visibility_mask);
+            
+            // arrays of constant blocks can only be bound through a table
+            if (binding.type == DESCRIPTOR_RANGE_CBV && binding.count == 1)
+            {
+                RootParameter param;
+                
+                bool root_constants = binding.push_constant || binding.size <= kMaxRootConstantBlockSize;
+                
+                param.type = root_constants ? ROOT_PARAMETER_CONSTANTS : ROOT_PARAMETER_CBV;
+                param.visibility = visibility;
+                param.shader_register = binding.shader_register;
+                param.space = binding.space;
+                param.num_constants = (binding.size + 3) / 4;
+                param.name = binding.name;
+                
+                root_signature.parameters.push_back(param);
+            }
+            else if (binding.type == DESCRIPTOR_RANGE_SAMPLER)
+                sampler_tables[std::make_pair(binding.set, uint32_t(visibility))].push_back(&binding);
+            else
+                tables[std::make_pair(binding.set, uint32_t(visibility))].push_back(&binding);
+        }
+        
+        // stay within the root signature size limit by demoting the largest root constants
+        auto total_cost = [&]()
+        {
+            uint32_t cost = uint32_t(tables.size() + sampler_tables.size());
+            
+            for (const RootParameter& param : root_signature.parameters)
+                cost += root_parameter_cost(param);
+            
+            return cost;
+        };
+        
+        while (total_cost() > kMaxRootSignatureDWords)
+        {
+            RootParameter* largest = nullptr;
+            
+            for (RootParameter& param : root_signature.parameters)
+            {
+                if (param.type == ROOT_PARAMETER_CONSTANTS && param.num_constants > 2 && (!largest || param.num_constants > largest->num_constants))
+                    largest = &param;
+            }
+            
+            if (!largest)
+            {
+                printf("Root signature exceeds %u DWORDs!\n", kMaxRootSignatureDWords);
+                return false;
+            }
+            
+            largest->type = ROOT_PARAMETER_CBV;
+        }
+        
+        for (int sampler = 0; sampler < 2; sampler++)
+        {
+            for (auto& table : sampler ? sampler_tables : tables)
+            {
+                std::vector<const RootBinding*> entries = table.second;
+                
+                std::sort(entries.begin(), entries.end(), [](const RootBinding* a, const RootBinding* b)
+                          {
+                              if (a->type != b->type)
+                                  return a->type < b->type;
+                              if (a->space != b->space)
+                                  return a->space < b->space;
+                              return a->shader_register < b->shader_register;
+                          });
+                
+                RootParameter param;
+                
+                param.type = ROOT_PARAMETER_DESCRIPTOR_TABLE;
+                param.visibility = ShaderVisibility(table.first.second);
+                param.shader_register = 0;
+                param.space = 0;
+                param.num_constants = 0;
+                param.name = "set" + std::to_string(table.first.first);
+                
+                // merge consecutive registers into a single range
+                for (const RootBinding* entry : entries)
+                {
+                    if (!param.ranges.empty())
+                    {
+                        DescriptorRange& last = param.ranges.back();
+                        
+                        if (last.type == entry->type && last.space == entry->space && last.base_register + last.count == entry->shader_register)
+                        {
+                            last.count += entry->count;
+                            continue;
+                        }
+                    }
+                    
+                    DescriptorRange range;
+                    
+                    range.type = entry->type;
+                    range.base_register = entry->shader_register;
+                    range.count = entry->count;
+                    range.space = entry->space;
+                    
+                    param.ranges.push_back(range);
+                }
+                
+                root_signature.parameters.push_back(param);
+            }
+        }
+        
+        root_signature.dword_count = 0;
+        
+        for (const RootParameter& param : root_signature.parameters)
+            root_signature.dword_count += root_parameter_cost(param);
+        
+        root_signature.hlsl = root_signature_to_hlsl(root_signature);
+        
+        return true;
+    }
+    
+    void reflect_workgroup_size(const spirv_cross::Compiler& compiler, WorkgroupSize& workgroup_size)
+    {
+        spirv_cross::SpecializationConstant constants[3];
+        compiler.get_work_group_size_specialization_constants(constants[0], constants[1], constants[2]);
+        
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            if (constants[i].id != 0)
+            {
+                workgroup_size.size[i] = compiler.get_constant(constants[i].id).scalar();
+                workgroup_size.constant_ids[i] = int32_t(constants[i].constant_id);
+            }
+            else
+            {
+                workgroup_size.size[i] = compiler.get_execution_mode_argument(spv::ExecutionModeLocalSize, i);
+                workgroup_size.constant_ids[i] = -1;
+            }
+        }
+    }
+    
+    // Overrides the local size of a compute shader. Dimensions driven by a specialization
+    // constant only get a new default value, so the constant_id can still be set at runtime.
+    void apply_workgroup_size(spirv_cross::Compiler& compiler, const CompileOptions& compile_options)
+    {
+        const uint32_t* size = compile_options.workgroup_size;
+        
+        if (compiler.get_execution_model() != spv::ExecutionModelGLCompute || (size[0] == 0 && size[1] == 0 && size[2] == 0))
+            return;
+        
+        spirv_cross::SpecializationConstant constants[3];
+        compiler.get_work_group_size_specialization_constants(constants[0], constants[1], constants[2]);
+        
+        uint32_t local_size[3];
+        
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            local_size[i] = compiler.get_execution_mode_argument(spv::ExecutionModeLocalSize, i);
+            
+            if (size[i] == 0)
+                continue;
+            
+            local_size[i] = size[i];
+            
+            if (constants[i].id != 0)
+                compiler.get_constant(constants[i].id).m.c[0].r[0].u32 = size[i];
+        }
+        
+        compiler.set_execution_mode(spv::ExecutionModeLocalSize, local_size[0], local_size[1], local_size[2]);
+    }
+    
+    bool is_minifiable(ShadingLanguage output_lang)
+    {
+        return output_lang == SHADING_LANGUAGE_GLSL_ES2 || output_lang == SHADING_LANGUAGE_GLSL_ES3 || output_lang == SHADING_LANGUAGE_MSL;
+    }
+    
+    const std::set<std::string> kMinifyReservedNames =
+    {
+        "do", "if", "in", "or", "abs", "all", "and", "any", "asm", "cos", "dot", "exp", "fma", "for", "int", "log", "max", "min",
+        "mix", "mod", "new", "not", "out", "pow", "sin", "tan", "try", "use", "xor", "auto", "bool", "case", "char", "else", "enum",
+        "goto", "half", "long", "main", "this", "true", "uint", "void", "false", "float"
+    };
+    
+    // Gives every value defined inside a function a short name (a, b, ..., aa, ab, ...) so
+    // SPIRV-Cross doesn't emit _123 style temporaries. Globals, functions, struct members and
+    // everything else that shows up in reflection keep their names.
+    void shorten_local_names(spirv_cross::Compiler& compiler, const std::vector<unsigned int>& spirv)
+    {
+        std::unordered_set<uint32_t> global_ids;
+        std::unordered_set<uint32_t> local_ids;
+        std::vector<uint32_t> ordered_ids;
+        std::set<std::string> existing_names;
+        bool in_function = false;
+        
+        for (size_t i = 5; i < spirv.size(); )
+        {
+            spv::Op op = spv::Op(spirv[i] & spv::OpCodeMask);
+            uint32_t word_count = spirv[i] >> spv::WordCountShift;
+            
+            if (word_count == 0 || i + word_count > spirv.size())
+                break;
+            
+            const uint32_t* words = &spirv[i];
+            i += word_count;
+            
+            if (op == spv::OpName && word_count > 2)
+                existing_names.insert(std::string((const char*)&words[2]));
+            else if (op == spv::OpFunction)
+            {
+                in_function = true;
+                global_ids.insert(words[2]);
+            }
+            else if (op == spv::OpFunctionEnd)
+                in_function = false;
+            else if (!in_function)
+            {
+                for (uint32_t w = 1; w < word_count; w++)
+                    global_ids.insert(words[w]);
+            }
+            else if (op == spv::OpLabel)
+                global_ids.insert(words[1]);
+            else if (word_count > 2 && op != spv::OpLine && op != spv::OpSelectionMerge && op != spv::OpLoopMerge &&
+                     op != spv::OpBranch && op != spv::OpBranchConditional && op != spv::OpSwitch && local_ids.insert(words[2]).second)
+                ordered_ids.push_back(words[2]);
+        }
+        
+        uint32_t counter = 0;
+        
+        for (uint32_t id : ordered_ids)
+        {
+            if (global_ids.count(id))
+                continue;
+            
+            std::string name;
+            
+            do
+            {
+                name.clear();
+                
+                for (uint32_t n = counter++; ; n = n / 26 - 1)
+                {
+                    name.insert(name.begin(), char('a' + n % 26));
+                    
+                    if (n < 26)
+                        break;
+                }
+            } while (kMinifyReservedNames.count(name) || existing_names.count(name) || name.compare(0, 2, "gl") == 0);
+            
+            compiler.set_name(id, name);
+        }
+    }
+    
+    bool is_word_char(char c)
+    {
+        return std::isalnum((unsigned char)c) || c == '_';
+    }
+    
+    const char* kMultiCharOperators[] =
+    {
+        "<<=", ">>=", "++", "--", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||", "^^",
+        "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "::", "->"
+    };
+    
+    // Splits source into words, operators and whole preprocessor lines, dropping whitespace
+    // and comments. Preprocessor lines are marked with a leading '\n'.
+    void tokenize_source(const std::string& source, std::vector<std::string>& tokens)
+    {
+        size_t i = 0;
+        bool line_start = true;
+        
+        while (i < source.size())
+        {
+            char c = source[i];
+            
+            if (c == '\n')
+            {
+                line_start = true;
+                i++;
+            }
+            else if (std::isspace((unsigned char)c))
+                i++;
+            else if (source.compare(i, 2, "//") == 0)
+                i = source.find('\n', i) == std::string::npos ? source.size() : source.find('\n', i);
+            else if (source.compare(i, 2, "/*") == 0)
+                i = source.find("*/", i + 2) == std::string::npos ? source.size() : source.find("*/", i + 2) + 2;
+            else if (c == '#' && line_start)
+            {
+                size_t end = i;
+                
+                // keep line continuations
+                do
+                {
+                    end = source.find('\n', end + 1);
+                } while (end != std::string::npos && end > 0 && source[end - 1] == '\\');
+                
+                std::string line = source.substr(i, end == std::string::npos ? std::string::npos : end - i);
+                
+                while (!line.empty() && std::isspace((unsigned char)line.back()))
+                    line.pop_back();
+                
+                tokens.push_back("\n" + line);
+                i = end == std::string::npos ? source.size() : end;
+            }
+            else if (std::isdigit((unsigned char)c) || (c == '.' && i + 1 < source.size() && std::isdigit((unsigned char)source[i + 1])))
+            {
+                size_t end = i;
+                bool hex = source.compare(i, 2, "0x") == 0 || source.compare(i, 2, "0X") == 0;
+                
+                while (end < source.size() && (is_word_char(source[end]) || source[end] == '.' ||
+                       (!hex && (source[end] == '+' || source[end] == '-') && (source[end - 1] == 'e' || source[end - 1] == 'E'))))
+                    end++;
+                
+                tokens.push_back(source.substr(i, end - i));
+                line_start = false;
+                i = end;
+            }
+            else if (is_word_char(c))
+            {
+                size_t end = i;
+                
+                while (end < source.size() && is_word_char(source[end]))
+                    end++;
+                
+                tokens.push_back(source.substr(i, end - i));
+                line_start = false;
+                i = end;
+            }
+            else
+            {
+                size_t length = 1;
+                
+                for (const char* op : kMultiCharOperators)
+                {
+                    if (source.compare(i, strlen(op), op) == 0)
+                    {
+                        length = strlen(op);
+                        break;
+                    }
+                }
+                
+                tokens.push_back(source.substr(i, length));
+                line_start = false;
+                i += length;
+            }
+        }
+    }
+    
+    bool is_assignment_token(const std::string& token)
+    {
+        return token == "=" || (token.size() >= 2 && token.back() == '=' && token != "==" && token != "!=" && token != "<=" && token != ">=");
+    }
+    
+    // Removes parentheses around complete expressions, i.e. groups that follow an assignment,
+    // 'return', '(' or ',' and are followed by ';', ',' or ')'. Groups containing a top-level
+    // comma are kept since they may be function arguments.
+    void fold_redundant_parentheses(std::vector<std::string>& tokens)
+    {
+        std::vector<size_t> matches(tokens.size(), 0);
+        std::vector<size_t> open;
+        std::vector<bool> top_level_comma(tokens.size(), false);
+        
+        for (size_t i = 0; i < tokens.size(); i++)
+        {
+            if (tokens[i] == "(")
+                open.push_back(i);
+            else if (tokens[i] == ")" && !open.empty())
+            {
+                matches[open.back()] = i;
+                open.pop_back();
+            }
+            else if (tokens[i] == "," && !open.empty())
+                top_level_comma[open.back()] = true;
+        }
+        
+        std::vector<bool> removed(tokens.size(), false);
+        
+        for (size_t i = 1; i < tokens.size(); i++)
+        {
+            size_t match = matches[i];
+            
+            if (tokens[i] != "(" || match == 0 || match == i + 1 || match + 1 >= tokens.size() || top_level_comma[i])
+                continue;
+            
+            const std::string& prev = tokens[i - 1];
+            const std::string& next = tokens[match + 1];
+            
+            if ((is_assignment_token(prev) || prev == "return" || prev == "(" || prev == ",") && (next == ";" || next == "," || next == ")"))
+            {
+                removed[i] = true;
+                removed[match] = true;
+            }
+        }
+        
+        size_t count = 0;
+        
+        for (size_t i = 0; i < tokens.size(); i++)
+        {
+            if (!removed[i])
+                tokens[count++] = tokens[i];
+        }
+        
+        tokens.resize(count);
+    }
+    
+    // Whether two adjacent tokens need a space between them to be read back unchanged.
+    bool needs_separator(const std::string& a, const std::string& b)
+    {
+        if (is_word_char(a.back()) && (is_word_char(b[0]) || (b[0] == '.' && b.size() > 1 && std::isdigit((unsigned char)b[1]))))
+            return true;
+        
+        if (is_word_char(a.back()) || is_word_char(b[0]))
+            return false;
+        
+        std::string joined = std::string(1, a.back()) + b[0];
+        
+        if (joined == "//" || joined == "/*" || joined == "*/")
+            return true;
+        
+        for (const char* op : kMultiCharOperators)
+        {
+            if (joined.compare(0, 2, op, 0, 2) == 0)
+                return true;
+        }
+        
+        return false;
+    }
+    
+    // Strips comments and whitespace and folds redundant parentheses. Preprocessor lines are
+    // kept on their own lines.
+    std::string minify_source(const std::string& source)
+    {
+        std::vector<std::string> tokens;
+        tokenize_source(source, tokens);
+        fold_redundant_parentheses(tokens);
+        
+        std::string output;
+        output.reserve(source.size());
+        
+        for (size_t i = 0; i < tokens.size(); i++)
+        {
+            const std::string& token = tokens[i];
+            
+            if (token[0] == '\n')
+            {
+                if (!output.empty() && output.back() != '\n')
+                    output += '\n';
+                
+                output.append(token, 1, std::string::npos);
+                output += '\n';
+                continue;
+            }
+            
+            if (!output.empty() && output.back() != '\n' && needs_separator(tokens[i - 1], token))
+                output += ' ';
+            
+            output += token;
+        }
+        
+        return output;
+    }
+    
+    // Applies the SPIR-V level transforms requested in the options, returning either the
+    // transformed module stored in 'storage' or the original one. 'precision_report', if given,
+    // receives what relax_precision demoted.
+    const std::vector<unsigned int>* transform_spirv(const std::vector<unsigned int>& spirv, ShadingLanguage output_lang, const CompileOptions& compile_options, std::vector<unsigned int>& storage,
+                                                     spirv_transform::PrecisionReport* precision_report = nullptr)
+    {
+        bool is_es = output_lang == SHADING_LANGUAGE_GLSL_ES2 || output_lang == SHADING_LANGUAGE_GLSL_ES3;
+        bool relax = compile_options.relax_precision && is_es;
+        
+        if (!compile_options.strip_unused_members && !relax)
+            return &spirv;
+        
+        storage = spirv;
+        
+        if (compile_options.strip_unused_members && !strip_unused_block_members(storage))
+            return nullptr;
+        
+        spirv_transform::PrecisionReport report;
+        
+        if (relax && !spirv_transform::relax_precision(storage, report))
+            return nullptr;
+        
+        if (relax && precision_report)
+            *precision_report = report;
+        
+        return &storage;
+    }
     
-    bool compile(const std::vector<unsigned int>& spirv, ShadingLanguage output_lang, std::string& output_src)
+    bool compile(const std::vector<unsigned int>& spirv, ShadingLanguage output_lang, std::string& output_src, const CompileOptions& compile_options, size_t* unminified_size,
+                 spirv_transform::PrecisionReport* precision_report)
     {
         if (spirv.size() == 0)
         {
@@ -101,9 +1408,19 @@ namespace cross_compiler
             return false;
         }
         
+        allocation_stats::ScopedStage allocation_stage(allocation_stats::STAGE_CROSS_COMPILE);
+        
+        std::vector<unsigned int> transformed_spirv;
+        const std::vector<unsigned int>* transformed = transform_spirv(spirv, output_lang, compile_options, transformed_spirv, precision_report);
+        
+        if (!transformed)
+            return false;
+        
+        const std::vector<unsigned int>& source_spirv = *transformed;
+        
         if (output_lang == SHADING_LANGUAGE_GLSL_ES2)
         {
-            spirv_cross::CompilerGLSL glsl(std::move(spirv));
+            spirv_cross::CompilerGLSL glsl(source_spirv.data(), source_spirv.size());
             glsl.build_combined_image_samplers();
             
             for (auto& remap : glsl.get_combined_image_samplers())
@@ -111,18 +1428,18 @@ namespace cross_compiler
                 glsl.set_name(remap.combined_id, glsl.get_name(remap.image_id));
             }
             
-            spirv_cross::ShaderResources resources = glsl.get_shader_resources();
+            spirv_cross::ShaderResources resources = shader_resources(glsl, compile_options);
             
             for(auto& ubo : resources.uniform_buffers)
             {
                 std::string baseType = glsl.get_name(ubo.base_type_id);
-                spirv_cross::SPIRType type = glsl.get_type(ubo.base_type_id);
+                const spirv_cross::SPIRType& type = glsl.get_type(ubo.base_type_id);
                 
                 std::cout << baseType << "\n" << std::endl;
                 
                 for(uint32_t i = 0; i < type.member_types.size(); i++)
                 {
-                    spirv_cross::SPIRType memberType = glsl.get_type(type.member_types[i]);
+                    const spirv_cross::SPIRType& memberType = glsl.get_type(type.member_types[i]);
                     std::cout << glsl.get_member_name(ubo.base_type_id, i) << ", Type: " << g_TypeTableStr[memberType.basetype] << ", Size: " << g_TypeTableSize[memberType.basetype];
                     
                     if(memberType.vecsize > 1 || memberType.columns > 1)
@@ -144,18 +1461,25 @@ namespace cross_compiler
                 glsl.set_name(ubo.id, name);
             }
             
+            if (compile_options.flatten_uniform_blocks)
+                flatten_uniform_blocks(glsl, resources);
+            
             spirv_cross::CompilerGLSL::Options options;
             options.version = 200;
             options.es = true;
             options.vulkan_semantics = false;
             options.enable_420pack_extension = true;
+            apply_precision_options(glsl, options, compile_options);
             glsl.set_common_options(options);
             
+            if (compile_options.minify)
+                shorten_local_names(glsl, source_spirv);
+            
             output_src = glsl.compile();
         }
         else if (output_lang == SHADING_LANGUAGE_GLSL_ES3)
         {
-            spirv_cross::CompilerGLSL glsl(std::move(spirv));
+            spirv_cross::CompilerGLSL glsl(source_spirv.data(), source_spirv.size());
             glsl.build_combined_image_samplers();
             
             for (auto &remap : glsl.get_combined_image_samplers())
@@ -163,7 +1487,9 @@ namespace cross_compiler
                 glsl.set_name(remap.combined_id, glsl.get_name(remap.image_id));
             }
             
-            spirv_cross::ShaderResources resources = glsl.get_shader_resources();
+            spirv_cross::ShaderResources resources = shader_resources(glsl, compile_options);
+            
+            apply_workgroup_size(glsl, compile_options);
             
             for(auto& ubo : resources.uniform_buffers)
             {
@@ -173,18 +1499,28 @@ namespace cross_compiler
                 glsl.set_name(ubo.id, baseType);
             }
             
+            if (compile_options.binding_remap)
+                apply_binding_remap(glsl, resources, output_lang, *compile_options.binding_remap);
+            
+            if (compile_options.flatten_uniform_blocks)
+                flatten_uniform_blocks(glsl, resources);
+            
             spirv_cross::CompilerGLSL::Options options;
             options.version = 310;
             options.es = true;
             options.vulkan_semantics = false;
             options.enable_420pack_extension = true;
+            apply_precision_options(glsl, options, compile_options);
             glsl.set_common_options(options);
             
+            if (compile_options.minify)
+                shorten_local_names(glsl, source_spirv);
+            
             output_src = glsl.compile();
         }
         else if (output_lang == SHADING_LANGUAGE_GLSL_450)
         {
-            spirv_cross::CompilerGLSL glsl(std::move(spirv));
+            spirv_cross::CompilerGLSL glsl(source_spirv.data(), source_spirv.size());
             glsl.build_combined_image_samplers();
             
             for (auto &remap : glsl.get_combined_image_samplers())
@@ -192,7 +1528,9 @@ namespace cross_compiler
                 glsl.set_name(remap.combined_id, glsl.get_name(remap.image_id));
             }
             
-            spirv_cross::ShaderResources resources = glsl.get_shader_resources();
+            spirv_cross::ShaderResources resources = shader_resources(glsl, compile_options);
+            
+            apply_workgroup_size(glsl, compile_options);
             
             for(auto& ubo : resources.uniform_buffers)
             {
@@ -202,6 +1540,12 @@ namespace cross_compiler
                 glsl.set_name(ubo.id, baseType);
             }
             
+            if (compile_options.binding_remap)
+                apply_binding_remap(glsl, resources, output_lang, *compile_options.binding_remap);
+            
+            if (compile_options.flatten_uniform_blocks)
+                flatten_uniform_blocks(glsl, resources);
+            
             spirv_cross::CompilerGLSL::Options options;
             options.version = 450;
             options.es = false;
@@ -213,7 +1557,7 @@ namespace cross_compiler
         }
         else if (output_lang == SHADING_LANGUAGE_GLSL_VK)
         {
-            spirv_cross::CompilerGLSL glsl(std::move(spirv));
+            spirv_cross::CompilerGLSL glsl(source_spirv.data(), source_spirv.size());
             
             spirv_cross::CompilerGLSL::Options options;
             options.version = 450;
@@ -222,7 +1566,9 @@ namespace cross_compiler
             options.enable_420pack_extension = true;
             glsl.set_common_options(options);
             
-            spirv_cross::ShaderResources resources = glsl.get_shader_resources();
+            spirv_cross::ShaderResources resources = shader_resources(glsl, compile_options);
+            
+            apply_workgroup_size(glsl, compile_options);
             
             for(auto& ubo : resources.uniform_buffers)
             {
@@ -232,21 +1578,30 @@ namespace cross_compiler
                 glsl.set_name(ubo.id, baseType);
             }
             
+            if (compile_options.native_16bit_types && uses_16bit_storage(glsl))
+                glsl.require_extension("GL_EXT_shader_16bit_storage");
+            
             output_src = glsl.compile();
         }
         else if (output_lang == SHADING_LANGUAGE_HLSL)
         {
-            spirv_cross::CompilerHLSL hlsl(std::move(spirv));
+            spirv_cross::CompilerHLSL hlsl(source_spirv.data(), source_spirv.size());
             
             spirv_cross::CompilerGLSL::Options common_options;
             hlsl.set_common_options(common_options);
             
+            /* native 16-bit types need shader model 6.2, otherwise half
+             precision values are emitted as min16float
+             */
             spirv_cross::CompilerHLSL::Options options;
-            options.shader_model = 50;
+            options.shader_model = compile_options.native_16bit_types ? 62 : 50;
+            options.enable_16bit_types = compile_options.native_16bit_types;
             
             hlsl.set_hlsl_options(options);
             
-            spirv_cross::ShaderResources resources = hlsl.get_shader_resources();
+            spirv_cross::ShaderResources resources = shader_resources(hlsl, compile_options);
+            
+            apply_workgroup_size(hlsl, compile_options);
             
             for(auto& ubo : resources.uniform_buffers)
             {
@@ -256,19 +1611,43 @@ namespace cross_compiler
                 hlsl.set_name(ubo.id, baseType);
             }
             
+            if (compile_options.binding_remap)
+                apply_binding_remap(hlsl, resources, output_lang, *compile_options.binding_remap);
+            
+            if (compile_options.hlsl_root_signature)
+                set_push_constant_root_layout(hlsl, resources);
+            
             fix_matrix_force_colmajor(hlsl);
             
             output_src = hlsl.compile();
         }
         else if (output_lang == SHADING_LANGUAGE_MSL)
         {
-            spirv_cross::CompilerMSL msl(std::move(spirv));
+            spirv_cross::CompilerMSL msl(source_spirv.data(), source_spirv.size());
             
             spirv_cross::CompilerMSL::Options options;
             
+            if (compile_options.msl_argument_buffer_tier > 0)
+            {
+                // argument buffers require MSL 2.0
+                options.msl_version = spirv_cross::CompilerMSL::Options::make_msl_version(2, 0);
+                options.argument_buffers = true;
+            }
+            
             msl.set_msl_options(options);
             
-            spirv_cross::ShaderResources resources = msl.get_shader_resources();
+            spirv_cross::ShaderResources resources = shader_resources(msl, compile_options);
+            
+            apply_workgroup_size(msl, compile_options);
+            
+            if (compile_options.msl_argument_buffer_tier > 0)
+            {
+                ArgumentBufferLayout layout;
+                build_argument_buffer_layout(msl, resources, compile_options.msl_argument_buffer_tier, layout);
+                apply_argument_buffer_layout(msl, layout);
+            }
+            else if (compile_options.binding_remap)
+                apply_msl_binding_remap(msl, resources, *compile_options.binding_remap);
             
             for(auto& ubo : resources.uniform_buffers)
             {
@@ -278,18 +1657,167 @@ namespace cross_compiler
                 msl.set_name(ubo.id, baseType);
             }
             
+            if (compile_options.minify)
+                shorten_local_names(msl, source_spirv);
+            
             output_src = msl.compile();
         }
         
+        if (unminified_size)
+            *unminified_size = output_src.size();
+        
+        if (compile_options.minify && is_minifiable(output_lang))
+        {
+            allocation_stats::ScopedStage output_stage(allocation_stats::STAGE_OUTPUT);
+            output_src = minify_source(output_src);
+        }
+        
         return true;
     }
 
-	bool compare_descriptors(Descriptor d1, Descriptor d2)
+	/* whether one of 'words' is a word of the name, e.g. "uv" in "inUV0" or "a_uv" but not in
+	 "curveParams". Words start at a case change, a digit or a separator, may span several
+	 words of the name ("texcoord" in "aTexCoord1") and may be followed by a plural 's'
+	 */
+	bool name_has_word(const std::string& name, std::initializer_list<const char*> words)
+	{
+		size_t length = name.size();
+		std::vector<bool> word_start(length + 1, true);
+
+		for (size_t i = 1; i < length; i++)
+		{
+			uint8_t previous = uint8_t(name[i - 1]);
+			uint8_t current = uint8_t(name[i]);
+			bool next_lower = i + 1 < length && std::islower(uint8_t(name[i + 1]));
+
+			if (std::islower(current))
+				word_start[i] = !std::isalpha(previous);
+			else if (std::isupper(current))
+				word_start[i] = !std::isupper(previous) || next_lower;
+			else if (std::isdigit(current))
+				word_start[i] = !std::isdigit(previous);
+		}
+
+		std::string lower = name;
+		std::transform(lower.begin(), lower.end(), lower.begin(), [](char c) { return char(std::tolower(uint8_t(c))); });
+
+		return std::any_of(words.begin(), words.end(), [&](const char* word) {
+			size_t word_length = strlen(word);
+
+			for (size_t i = 0; i + word_length <= length; i++)
+			{
+				if (!word_start[i] || !std::isalnum(uint8_t(name[i])) || lower.compare(i, word_length, word) != 0)
+					continue;
+
+				size_t end = i + word_length;
+
+				if (end < length && lower[end] == 's' && word_start[end + 1])
+					end++;
+
+				if (word_start[end])
+					return true;
+			}
+
+			return false;
+		});
+	}
+
+	/* picks the smallest format that usually holds the attribute without visible
+	 loss: directions as snorm16, colors and weights as unorm8, texture coordinates and
+	 mediump values as half, everything else at full size. 3 component 8 and 16-bit
+	 formats are padded to 4 since they aren't supported everywhere
+	 */
+	std::string recommend_vertex_format(const std::string& name, const spirv_cross::SPIRType& type, bool relaxed_precision)
+	{
+		uint32_t components = type.vecsize;
+		std::string count = components > 1 ? std::to_string(components) : "";
+		std::string padded = std::to_string(components == 3 ? 4 : components);
+		std::string padded_count = components > 1 ? padded : "";
+		std::string normalized_count = components > 1 ? "x" + padded : "";
+
+		switch (type.basetype)
+		{
+			case spirv_cross::SPIRType::Float:
+				if (type.columns == 1)
+				{
+					if (name_has_word(name, { "normal", "tangent" }))
+						return "snorm16" + normalized_count;
+
+					if (name_has_word(name, { "color", "colour", "weight" }))
+						return "unorm8" + normalized_count;
+
+					if (relaxed_precision || name_has_word(name, { "uv", "texcoord" }))
+						return "half" + padded_count;
+				}
+
+				return "float" + count;
+			case spirv_cross::SPIRType::Half:
+				return "half" + padded_count;
+			case spirv_cross::SPIRType::Int:
+				return "int" + count;
+			case spirv_cross::SPIRType::UInt:
+				return "uint" + count;
+			case spirv_cross::SPIRType::Short:
+				return "short" + padded_count;
+			case spirv_cross::SPIRType::UShort:
+				return "ushort" + padded_count;
+			case spirv_cross::SPIRType::SByte:
+				return "char" + padded_count;
+			case spirv_cross::SPIRType::UByte:
+				return "uchar" + padded_count;
+			default:
+				return "";
+		}
+	}
+
+	bool reflect_vertex_inputs(const std::vector<unsigned int>& spirv, std::vector<VertexInput>& inputs)
+	{
+		spirv_cross::Compiler compiler(spirv.data(), spirv.size());
+
+		if (compiler.get_execution_model() != spv::ExecutionModelVertex)
+			return false;
+
+		auto active = compiler.get_active_interface_variables();
+		spirv_cross::ShaderResources resources = compiler.get_shader_resources();
+
+		inputs.clear();
+
+		for (const spirv_cross::Resource& resource : resources.stage_inputs)
+		{
+			if (compiler.has_decoration(resource.id, spv::DecorationBuiltIn))
+				continue;
+
+			const spirv_cross::SPIRType& type = compiler.get_type(resource.type_id);
+
+			VertexInput input;
+			input.name = resource.name;
+			input.location = compiler.get_decoration(resource.id, spv::DecorationLocation);
+			input.locations = type.columns;
+			input.components = type.vecsize;
+			input.type = g_TypeTableStr[type.basetype];
+			input.relaxed_precision = compiler.has_decoration(resource.id, spv::DecorationRelaxedPrecision);
+			input.used = active.count(resource.id) != 0;
+			input.format = recommend_vertex_format(input.name, type, input.relaxed_precision);
+
+			for (uint32_t size : type.array)
+				input.locations *= size;
+
+			inputs.push_back(input);
+		}
+
+		std::sort(inputs.begin(), inputs.end(), [](const VertexInput& a, const VertexInput& b) {
+			return a.location < b.location;
+		});
+
+		return true;
+	}
+
+	bool compare_descriptors(const Descriptor& d1, const Descriptor& d2)
 	{
 		return d1.binding < d2.binding;
 	}
 
-	bool generate_reflection_data(const std::vector<unsigned int>& spirv, ShadingLanguage output_lang, ReflectionData& reflection_data)
+	bool generate_reflection_data(const std::vector<unsigned int>& spirv, ShadingLanguage output_lang, ReflectionData& reflection_data, const CompileOptions& compile_options)
 	{
 		const std::string kDescriptorTypes[] =
 		{
@@ -301,9 +1829,11 @@ namespace cross_compiler
 			"DESCRIPTOR_TYPE_PUSH_CONSTANT"
 		};
 
+		allocation_stats::ScopedStage allocation_stage(allocation_stats::STAGE_CROSS_COMPILE);
+
 		if (output_lang == SHADING_LANGUAGE_GLSL_VK)
 		{
-			spirv_cross::CompilerGLSL glsl(std::move(spirv));
+			spirv_cross::CompilerGLSL glsl(spirv.data(), spirv.size());
 
 			spirv_cross::CompilerGLSL::Options options;
 			options.version = 450;
@@ -312,7 +1842,7 @@ namespace cross_compiler
 			options.enable_420pack_extension = true;
 			glsl.set_common_options(options);
 
-			spirv_cross::ShaderResources resources = glsl.get_shader_resources();
+			spirv_cross::ShaderResources resources = shader_resources(glsl, compile_options);
 
 			for (const spirv_cross::Resource &resource : resources.separate_images)
 			{
@@ -390,11 +1920,11 @@ namespace cross_compiler
 				uint32_t binding = glsl.get_decoration(resource.id, spv::DecorationBinding);
 
 				std::string baseType = glsl.get_name(resource.base_type_id);
-				spirv_cross::SPIRType type = glsl.get_type(resource.base_type_id);
+				const spirv_cross::SPIRType& type = glsl.get_type(resource.base_type_id);
 
 				for (uint32_t i = 0; i < type.member_types.size(); i++)
 				{
-					spirv_cross::SPIRType memberType = glsl.get_type(type.member_types[i]);
+					const spirv_cross::SPIRType& memberType = glsl.get_type(type.member_types[i]);
 
 					PushConstantMembers desc;
 					
@@ -407,6 +1937,8 @@ namespace cross_compiler
 				}
 			}
 
+			find_unused_block_members(glsl, resources, reflection_data.unused_block_members);
+
 			std::cout << "Push Constant Members : " << std::endl;
 
 			for (auto& member : reflection_data.push_constant_members)
@@ -430,6 +1962,77 @@ namespace cross_compiler
 					std::cout << "\tName = " << binding.name << std::endl;
 				}
 			}
+
+			std::cout << "Unused Block Members : " << std::endl;
+
+			for (auto& member : reflection_data.unused_block_members)
+			{
+				std::cout << "\tBlock = " << member.block << std::endl;
+				std::cout << "\tName = " << member.name << std::endl;
+				std::cout << "\tOffset = " << member.offset << std::endl;
+				std::cout << "\tSize = " << member.size << std::endl;
+			}
+		}
+		else if (compile_options.flatten_uniform_blocks && output_lang != SHADING_LANGUAGE_HLSL && output_lang != SHADING_LANGUAGE_MSL)
+		{
+			std::vector<unsigned int> transformed_spirv;
+			const std::vector<unsigned int>* transformed = transform_spirv(spirv, output_lang, compile_options, transformed_spirv);
+
+			if (!transformed)
+				return false;
+
+			spirv_cross::Compiler compiler(*transformed);
+			spirv_cross::ShaderResources resources = shader_resources(compiler, compile_options);
+
+			reflect_flattened_blocks(compiler, resources, reflection_data.flattened_uniform_blocks);
+
+			for (auto& block : reflection_data.flattened_uniform_blocks)
+			{
+				std::cout << "Flattened Block = " << block.name << "[" << block.vec4_count << "]" << std::endl;
+
+				for (auto& member : block.members)
+				{
+					std::cout << "\tName = " << member.name << std::endl;
+					std::cout << "\tType = " << member.type << std::endl;
+					std::cout << "\tVec4 Offset = " << member.vec4_offset << std::endl;
+					std::cout << "\tComponent = " << member.component << std::endl;
+					std::cout << "\tArray Size = " << member.array_size << std::endl;
+				}
+			}
+		}
+
+		spirv_cross::Compiler compiler(spirv);
+
+		if (compiler.get_execution_model() == spv::ExecutionModelGLCompute)
+		{
+			apply_workgroup_size(compiler, compile_options);
+			reflect_workgroup_size(compiler, reflection_data.workgroup_size);
+
+			std::cout << "Workgroup Size : " << std::endl;
+
+			for (uint32_t i = 0; i < 3; i++)
+			{
+				std::cout << "\t" << "XYZ"[i] << " = " << reflection_data.workgroup_size.size[i];
+
+				if (reflection_data.workgroup_size.constant_ids[i] >= 0)
+					std::cout << " (constant_id = " << reflection_data.workgroup_size.constant_ids[i] << ")";
+
+				std::cout << std::endl;
+			}
+		}
+
+		if (reflect_vertex_inputs(spirv, reflection_data.vertex_inputs))
+		{
+			std::cout << "Vertex Inputs : " << std::endl;
+
+			for (auto& input : reflection_data.vertex_inputs)
+			{
+				std::cout << "\tLocation = " << input.location << std::endl;
+				std::cout << "\tName = " << input.name << std::endl;
+				std::cout << "\tType = " << input.type << " x " << input.components << std::endl;
+				std::cout << "\tUsed = " << (input.used ? "true" : "false") << std::endl;
+				std::cout << "\tFormat = " << input.format << std::endl;
+			}
 		}
 
 		return true;
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "spirv_transform.h"
+
 #include <vector>
 #include <string>
 #include <unordered_map>
@@ -25,6 +27,14 @@ namespace cross_compiler
 		DESCRIPTOR_TYPE_IMAGE
 	};
 
+	enum Precision
+	{
+		PRECISION_DEFAULT,
+		PRECISION_LOWP,
+		PRECISION_MEDIUMP,
+		PRECISION_HIGHP
+	};
+
 	struct PushConstantMembers
 	{
 		uint32_t offset;
@@ -40,12 +50,184 @@ namespace cross_compiler
 		std::string name;
 	};
 
+	struct BlockMember
+	{
+		std::string block;
+		std::string name;
+		uint32_t index;
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	struct FlattenedMember
+	{
+		std::string name;
+		std::string type;
+		uint32_t vec4_offset;
+		uint32_t component;
+		uint32_t array_size;
+	};
+
+	struct FlattenedUniformBlock
+	{
+		std::string name;
+		uint32_t vec4_count;
+		std::vector<FlattenedMember> members;
+	};
+
+	struct ArgumentBufferResource
+	{
+		DescriptorType type;
+		uint32_t set;
+		uint32_t binding;
+		uint32_t index;
+		std::string name;
+	};
+
+	struct ArgumentBufferLayout
+	{
+		std::vector<uint32_t> argument_buffer_sets;
+		std::vector<uint32_t> discrete_sets;
+		std::vector<ArgumentBufferResource> resources;
+	};
+
+	enum RootParameterType
+	{
+		ROOT_PARAMETER_CONSTANTS,
+		ROOT_PARAMETER_CBV,
+		ROOT_PARAMETER_DESCRIPTOR_TABLE
+	};
+
+	enum ShaderVisibility
+	{
+		SHADER_VISIBILITY_ALL,
+		SHADER_VISIBILITY_VERTEX,
+		SHADER_VISIBILITY_PIXEL
+	};
+
+	enum DescriptorRangeType
+	{
+		DESCRIPTOR_RANGE_SRV,
+		DESCRIPTOR_RANGE_UAV,
+		DESCRIPTOR_RANGE_CBV,
+		DESCRIPTOR_RANGE_SAMPLER
+	};
+
+	struct DescriptorRange
+	{
+		DescriptorRangeType type;
+		uint32_t base_register;
+		uint32_t count;
+		uint32_t space;
+	};
+
+	struct RootParameter
+	{
+		RootParameterType type;
+		ShaderVisibility visibility;
+		uint32_t shader_register;
+		uint32_t space;
+		uint32_t num_constants;
+		std::string name;
+		std::vector<DescriptorRange> ranges;
+	};
+
+	struct RootSignature
+	{
+		bool allow_input_layout;
+		uint32_t dword_count;
+		std::vector<RootParameter> parameters;
+		std::string hlsl;
+	};
+
+	struct BindingRemap
+	{
+		DescriptorType type;
+		uint32_t set;
+		uint32_t binding;
+		std::string name;
+		bool combined;               // combined image sampler, also occupies a sampler slot
+		uint32_t hlsl_register;      // dense per register class (b, t, u, s); space 0
+		uint32_t msl_index;          // dense per buffer/texture/sampler index space
+		uint32_t msl_sampler_index;  // sampler index of combined image samplers
+		uint32_t glsl_binding;       // dense per UBO/SSBO/texture unit/image unit binding point
+	};
+
+	struct BindingRemapTable
+	{
+		std::vector<BindingRemap> bindings;
+	};
+
+	struct WorkgroupSize
+	{
+		uint32_t size[3] = { 0, 0, 0 };          // effective local size, zero for non-compute shaders
+		int32_t constant_ids[3] = { -1, -1, -1 }; // specialization constant driving each dimension, -1 if none
+	};
+
+	struct VertexInput
+	{
+		std::string name;
+		uint32_t location;
+		uint32_t locations;          // consecutive locations taken by matrix and array inputs
+		uint32_t components;
+		std::string type;            // base type, from the same table as push constant members
+		bool relaxed_precision;      // declared mediump or lowp
+		bool used;                   // statically read by the entry point
+		std::string format;          // recommended packed vertex format, e.g. snorm16x4 or half2
+	};
+
 	struct ReflectionData
 	{
 		std::vector<PushConstantMembers> push_constant_members;
 		std::unordered_map<uint32_t, std::vector<Descriptor>> descriptor_sets;
+		std::vector<BlockMember> unused_block_members;
+		std::vector<FlattenedUniformBlock> flattened_uniform_blocks;
+		WorkgroupSize workgroup_size;
+		std::vector<VertexInput> vertex_inputs;
+	};
+
+	struct CompileOptions
+	{
+		// Only declare the resources and interface variables the entry point statically uses.
+		bool strip_unused_resources = false;
+		// Remove uniform block members that are never read from the end of each block.
+		bool strip_unused_members = false;
+		// Emit each float-only uniform block as a single vec4 array uniform (GLSL ES2, ES3 and 450).
+		bool flatten_uniform_blocks = false;
+		// Default float precision of GLSL ES fragment and vertex shaders.
+		Precision fragment_precision = PRECISION_DEFAULT;
+		Precision vertex_precision = PRECISION_DEFAULT;
+		// Mark values that only feed color outputs or texture coordinates as mediump (GLSL ES).
+		bool relax_precision = false;
+		// Keep 16-bit types native: SM 6.2 for HLSL, half for MSL, 16-bit storage for Vulkan GLSL.
+		bool native_16bit_types = false;
+		// Group each descriptor set into a Metal argument buffer. 0 disables them, 1 or 2 selects
+		// the argument buffer tier. Tier 1 keeps sets with writable textures as discrete slots.
+		uint32_t msl_argument_buffer_tier = 0;
+		// Bind HLSL push constants to a fixed root constant register so a root signature can be
+		// generated for them with generate_root_signature.
+		bool hlsl_root_signature = false;
+		// Pipeline wide binding remap table from generate_binding_remap, applied to the HLSL,
+		// MSL, GLSL ES3 and GLSL 450 backends.
+		const BindingRemapTable* binding_remap = nullptr;
+		// Local size override of compute shaders, zero keeps the size declared in the shader.
+		uint32_t workgroup_size[3] = { 0, 0, 0 };
+		// Strip whitespace and comments, shorten local identifiers and fold redundant parentheses
+		// in GLSL ES and MSL outputs. Names that show up in reflection are kept.
+		bool minify = false;
 	};
     
-    extern bool compile(const std::vector<unsigned int>& spirv, ShadingLanguage output_lang, std::string& output_src);
-	extern bool generate_reflection_data(const std::vector<unsigned int>& spirv, ShadingLanguage output_lang, ReflectionData& reflection_data);
+    // 'unminified_size' receives the size of the output before minify_source removed the
+    // whitespace and comments, or the final size when the output isn't minified.
+    // 'precision_report' receives what relax_precision demoted to mediump. It is left untouched
+    // when the option doesn't apply to 'output_lang'.
+    extern bool compile(const std::vector<unsigned int>& spirv, ShadingLanguage output_lang, std::string& output_src, const CompileOptions& compile_options = CompileOptions(), size_t* unminified_size = nullptr,
+                        spirv_transform::PrecisionReport* precision_report = nullptr);
+	extern bool generate_argument_buffer_layout(const std::vector<unsigned int>& spirv, const CompileOptions& compile_options, ArgumentBufferLayout& layout);
+	extern bool generate_root_signature(const std::vector<std::vector<unsigned int>>& stages, const CompileOptions& compile_options, RootSignature& root_signature);
+	extern bool generate_binding_remap(const std::vector<std::vector<unsigned int>>& stages, const CompileOptions& compile_options, BindingRemapTable& table);
+	// Lists the inputs of a vertex shader in location order. Returns false if 'spirv' isn't a
+	// vertex shader.
+	extern bool reflect_vertex_inputs(const std::vector<unsigned int>& spirv, std::vector<VertexInput>& inputs);
+	extern bool generate_reflection_data(const std::vector<unsigned int>& spirv, ShadingLanguage output_lang, ReflectionData& reflection_data, const CompileOptions& compile_options = CompileOptions());
 }
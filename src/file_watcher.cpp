@@ -0,0 +1,215 @@
+#include "file_watcher.h"
+
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+namespace file_watcher
+{
+#ifdef __linux__
+    const uint32_t kWatchMask = IN_CLOSE_WRITE | IN_MOVED_TO;
+    
+    struct Watcher
+    {
+        int fd;
+        std::unordered_map<int, std::string> directories;      // watch descriptor -> directory
+        std::unordered_map<std::string, int> directory_watches;
+        std::unordered_map<std::string, std::vector<std::string>> files;  // resolved path -> watched paths
+    };
+    
+    // Resolves symlinks and relative components. Files that don't exist yet are resolved
+    // through their directory.
+    bool resolve_path(const std::string& path, std::string& directory, std::string& resolved)
+    {
+        size_t slash = path.find_last_of('/');
+        std::string parent = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+        std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+        char buffer[PATH_MAX];
+        
+        if (realpath(parent.c_str(), buffer) == nullptr)
+            return false;
+        
+        directory = buffer;
+        resolved = directory + (directory == "/" ? "" : "/") + name;
+        
+        if (realpath(path.c_str(), buffer) != nullptr)
+        {
+            resolved = buffer;
+            directory = resolved.substr(0, std::max<size_t>(resolved.find_last_of('/'), 1));
+        }
+        
+        return true;
+    }
+    
+    Watcher* create_watcher()
+    {
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        
+        if (fd < 0)
+        {
+            printf("ERROR: Failed to initialize inotify!\n");
+            return nullptr;
+        }
+        
+        Watcher* watcher = new Watcher();
+        watcher->fd = fd;
+        
+        return watcher;
+    }
+    
+    void destroy_watcher(Watcher* watcher)
+    {
+        if (watcher == nullptr)
+            return;
+        
+        close(watcher->fd);
+        delete watcher;
+    }
+    
+    bool watch_files(Watcher* watcher, const std::vector<std::string>& paths)
+    {
+        std::unordered_set<std::string> directories;
+        
+        watcher->files.clear();
+        
+        for (const std::string& path : paths)
+        {
+            std::string directory;
+            std::string resolved;
+            
+            if (!resolve_path(path, directory, resolved))
+            {
+                printf("WARNING: Can't watch %s\n", path.c_str());
+                continue;
+            }
+            
+            watcher->files[resolved].push_back(path);
+            directories.insert(directory);
+        }
+        
+        for (const std::string& directory : directories)
+        {
+            if (watcher->directory_watches.count(directory))
+                continue;
+            
+            int wd = inotify_add_watch(watcher->fd, directory.c_str(), kWatchMask);
+            
+            if (wd < 0)
+            {
+                printf("ERROR: Failed to watch %s\n", directory.c_str());
+                return false;
+            }
+            
+            watcher->directories[wd] = directory;
+            watcher->directory_watches[directory] = wd;
+        }
+        
+        // stop watching directories that no longer contain a watched file
+        for (auto it = watcher->directory_watches.begin(); it != watcher->directory_watches.end(); )
+        {
+            if (directories.count(it->first))
+            {
+                ++it;
+                continue;
+            }
+            
+            inotify_rm_watch(watcher->fd, it->second);
+            watcher->directories.erase(it->second);
+            it = watcher->directory_watches.erase(it);
+        }
+        
+        return true;
+    }
+    
+    // Reads the pending events and adds the watched files they refer to.
+    bool read_events(Watcher* watcher, std::unordered_set<std::string>& changed)
+    {
+        alignas(inotify_event) char buffer[16 * 1024];
+        
+        while (true)
+        {
+            ssize_t length = read(watcher->fd, buffer, sizeof(buffer));
+            
+            if (length < 0)
+                return errno == EAGAIN || errno == EINTR;
+            
+            for (char* ptr = buffer; ptr < buffer + length; )
+            {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(ptr);
+                ptr += sizeof(inotify_event) + event->len;
+                
+                auto directory = watcher->directories.find(event->wd);
+                
+                if (directory == watcher->directories.end() || event->len == 0)
+                    continue;
+                
+                std::string path = directory->second + (directory->second == "/" ? "" : "/") + event->name;
+                auto file = watcher->files.find(path);
+                
+                if (file != watcher->files.end())
+                    changed.insert(file->second.begin(), file->second.end());
+            }
+        }
+    }
+    
+    bool wait_for_changes(Watcher* watcher, uint32_t debounce_ms, std::vector<std::string>& changed)
+    {
+        std::unordered_set<std::string> changed_set;
+        
+        while (true)
+        {
+            pollfd fd = { watcher->fd, POLLIN, 0 };
+            int ready = poll(&fd, 1, changed_set.empty() ? -1 : int(debounce_ms));
+            
+            if (ready < 0 && errno != EINTR)
+                return false;
+            
+            // quiet for the debounce interval after the last change
+            if (ready == 0)
+                break;
+            
+            if (!read_events(watcher, changed_set))
+                return false;
+        }
+        
+        changed.assign(changed_set.begin(), changed_set.end());
+        std::sort(changed.begin(), changed.end());
+        
+        return true;
+    }
+#else
+    struct Watcher
+    {
+    };
+    
+    Watcher* create_watcher()
+    {
+        printf("ERROR: File watching is only supported on Linux!\n");
+        return nullptr;
+    }
+    
+    void destroy_watcher(Watcher* watcher)
+    {
+    }
+    
+    bool watch_files(Watcher* watcher, const std::vector<std::string>& paths)
+    {
+        return false;
+    }
+    
+    bool wait_for_changes(Watcher* watcher, uint32_t debounce_ms, std::vector<std::string>& changed)
+    {
+        return false;
+    }
+#endif
+}
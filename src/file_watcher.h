@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace file_watcher
+{
+    struct Watcher;
+    
+    // Returns nullptr if file watching isn't supported on this platform (Linux only).
+    extern Watcher* create_watcher();
+    extern void destroy_watcher(Watcher* watcher);
+    
+    // Replaces the set of watched files. The directories containing them are watched rather
+    // than the files, so editors that save by replacing the file are picked up as well.
+    extern bool watch_files(Watcher* watcher, const std::vector<std::string>& paths);
+    
+    // Blocks until a watched file is written, then keeps collecting changes until none arrive
+    // for 'debounce_ms'. 'changed' receives the paths as they were passed to watch_files.
+    extern bool wait_for_changes(Watcher* watcher, uint32_t debounce_ms, std::vector<std::string>& changed);
+}
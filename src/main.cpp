@@ -1,11 +1,30 @@
 #include "spirv_compiler.h"
 #include "cross_compiler.h"
+#include "spirv_transform.h"
+#include "worker_pool.h"
+#include "file_watcher.h"
+#include "allocation_stats.h"
+#include "pipeline.h"
+#include "compile_queue.h"
 
 #include <fstream>
 #include <iostream>
 #include <unordered_map>
 #include <unordered_set>
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#ifdef WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
 
 class ArgumentParser
 {
@@ -116,124 +135,2301 @@ std::string file_name_from_path(std::string filepath)
     return filename;
 }
 
-void print_usage()
+const char* kShaderExtensions[] =
 {
-    printf("Usage: dwShaderCrossCompiler [option]... [input] [output_path]\n"
-           "\n"
-           "'input' is the GLSL shader source to be cross-compiled.\n"
-           "'output_path' is the output path of the cross-compiled output.\n"
-           "\n"
-           "Options:\n"
-		   "  --vulkan-glsl					  Use this flag to indicate that the input is in Vulkan GLSL"
-           "  --shader-stage=<stage>          The shader stage corresponding to the input shader\n"
-           "                                  source (vertex, fragment or compute).\n"
-           "  --target-language=<language>    Target shading language that the input shader source\n"
-           "                                  must be cross-compiled into (GLSL_ES2, GLSL_ES3, GLSL_450,\n"
-           "                                  GLSL_VK, HLSL or MSL).\n"
-           );
+    "_es2.glsl",
+    "_es3.glsl",
+    "_450.glsl",
+    "_vk.glsl",
+    ".hlsl",
+    ".metal"
+};
+
+std::string output_file_path(std::string output_path, std::string file_name, std::string suffix)
+{
+    std::string write_path = output_path;
+    
+    if (write_path == "")
+        write_path = write_path + file_name;
+    else
+    {
+        write_path = write_path + "/";
+        write_path = write_path + file_name;
+    }
+    
+    return write_path + suffix;
 }
 
-int main(int argc, char* argv[])
+// Writes to a temporary file next to 'path' and renames it over the target, so readers such as
+// an engine hot-reloading the output never see a partially written file.
+bool write_file_atomic(const std::string& path, std::string contents)
 {
-    ArgumentParser parser;
+    allocation_stats::ScopedStage allocation_stage(allocation_stats::STAGE_OUTPUT);
     
-	parser.add_bool_option("vulkan-glsl");
-    parser.add_option("shader-stage");
-    parser.add_option("target-language");
+    // inside a pipeline the writer thread does the same, batching the renames
+    if (pipeline::writing_outputs())
+    {
+        pipeline::write_output(path, std::move(contents));
+        return true;
+    }
+    
+    std::string temp_path = path + ".tmp";
+    std::ofstream out(temp_path);
+    out << contents;
+    out.close();
+    
+    if (!out)
+    {
+        printf("ERROR: Failed to write %s\n", temp_path.c_str());
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    
+#ifdef WIN32
+    bool renamed = MoveFileExA(temp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool renamed = std::rename(temp_path.c_str(), path.c_str()) == 0;
+#endif
+    
+    if (!renamed)
+    {
+        printf("ERROR: Failed to write %s\n", path.c_str());
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    
+    return true;
+}
 
-    if (argc > 1)
+// Quotes 'text' as a JSON string. Paths and names can hold backslashes (Windows paths),
+// quotes or control characters.
+std::string json_string(const std::string& text)
+{
+    std::string quoted = "\"";
+    
+    for (char c : text)
     {
-        parser.parse(argc, argv);
+        switch (c)
+        {
+            case '"': quoted += "\\\""; break;
+            case '\\': quoted += "\\\\"; break;
+            case '\n': quoted += "\\n"; break;
+            case '\r': quoted += "\\r"; break;
+            case '\t': quoted += "\\t"; break;
+            default:
+                if (uint8_t(c) < 0x20)
+                {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", unsigned(uint8_t(c)));
+                    quoted += escaped;
+                }
+                else
+                    quoted += c;
+                break;
+        }
+    }
+    
+    return quoted + "\"";
+}
+
+const char* kDescriptorTypeNames[] =
+{
+    "ubo",
+    "ssbo",
+    "sampler",
+    "texture",
+    "image"
+};
+
+bool write_argument_buffer_layout(const cross_compiler::ArgumentBufferLayout& layout, std::string write_path)
+{
+    std::ostringstream out;
+    
+    out << "{\n";
+    out << "    \"argument_buffer_sets\": [";
+    
+    for (size_t i = 0; i < layout.argument_buffer_sets.size(); i++)
+        out << (i > 0 ? ", " : "") << layout.argument_buffer_sets[i];
+    
+    out << "],\n";
+    out << "    \"discrete_sets\": [";
+    
+    for (size_t i = 0; i < layout.discrete_sets.size(); i++)
+        out << (i > 0 ? ", " : "") << layout.discrete_sets[i];
+    
+    out << "],\n";
+    out << "    \"resources\": [\n";
+    
+    for (size_t i = 0; i < layout.resources.size(); i++)
+    {
+        const cross_compiler::ArgumentBufferResource& resource = layout.resources[i];
         
-        std::vector<unsigned int> spirv;
+        out << "        { \"name\": " << json_string(resource.name) << ", \"type\": \"" << kDescriptorTypeNames[resource.type]
+            << "\", \"set\": " << resource.set << ", \"binding\": " << resource.binding << ", \"index\": " << resource.index << " }"
+            << (i + 1 < layout.resources.size() ? ",\n" : "\n");
+    }
     
-        std::string input_path = parser.ordered_argument(0);
-        std::string output_path = parser.ordered_argument(1);
-        std::string shader_stage = parser.argument("shader-stage");
-        std::string target_lang = parser.argument("target-language");
-		bool is_vulkan_glsl = parser.bool_argument("vulkan-glsl");
+    out << "    ]\n";
+    out << "}\n";
+    
+    return write_file_atomic(write_path, out.str());
+}
+
+bool write_root_signature(const cross_compiler::RootSignature& root_signature, std::string output_path, std::string file_name)
+{
+    const char* kParameterTypes[] = { "root_constants", "cbv", "descriptor_table" };
+    const char* kVisibilities[] = { "all", "vertex", "pixel" };
+    const char* kRangeTypes[] = { "srv", "uav", "cbv", "sampler" };
+    
+    if (!write_file_atomic(output_file_path(output_path, file_name, "_rootsig.hlsl"), "#define ROOT_SIGNATURE \"" + root_signature.hlsl + "\"\n"))
+        return false;
+    
+    std::ostringstream out;
+    
+    out << "{\n";
+    out << "    \"allow_input_layout\": " << (root_signature.allow_input_layout ? "true" : "false") << ",\n";
+    out << "    \"dword_count\": " << root_signature.dword_count << ",\n";
+    out << "    \"parameters\": [\n";
+    
+    for (size_t i = 0; i < root_signature.parameters.size(); i++)
+    {
+        const cross_compiler::RootParameter& param = root_signature.parameters[i];
         
-        if (output_path == "")
-            output_path = path_without_file(input_path);
+        out << "        { \"name\": " << json_string(param.name) << ", \"type\": \"" << kParameterTypes[param.type]
+            << "\", \"visibility\": \"" << kVisibilities[param.visibility] << "\"";
         
-        std::string file_name = file_name_from_path(input_path);
-  
-        std::unordered_map<std::string, spirv_compiler::ShaderStage> shader_stage_map =
+        if (param.type == cross_compiler::ROOT_PARAMETER_DESCRIPTOR_TABLE)
         {
-            { "vertex", spirv_compiler::SHADER_STAGE_VERTEX },
-            { "fragment", spirv_compiler::SHADER_STAGE_FRAGMENT },
-            { "compute", spirv_compiler::SHADER_STAGE_COMPUTE }
-        };
-        
-        std::unordered_map<std::string, cross_compiler::ShadingLanguage> target_lang_map =
+            out << ", \"ranges\": [";
+            
+            for (size_t r = 0; r < param.ranges.size(); r++)
+            {
+                const cross_compiler::DescriptorRange& range = param.ranges[r];
+                
+                out << (r > 0 ? ", " : "") << "{ \"type\": \"" << kRangeTypes[range.type] << "\", \"register\": " << range.base_register
+                    << ", \"count\": " << range.count << ", \"space\": " << range.space << " }";
+            }
+            
+            out << "]";
+        }
+        else
         {
-            { "GLSL_ES2", cross_compiler::SHADING_LANGUAGE_GLSL_ES2 },
-            { "GLSL_ES3", cross_compiler::SHADING_LANGUAGE_GLSL_ES3 },
-            { "GLSL_450", cross_compiler::SHADING_LANGUAGE_GLSL_450 },
-            { "GLSL_VK", cross_compiler::SHADING_LANGUAGE_GLSL_VK },
-            { "HLSL", cross_compiler::SHADING_LANGUAGE_HLSL },
-            { "MSL", cross_compiler::SHADING_LANGUAGE_MSL }
-        };
+            out << ", \"register\": " << param.shader_register << ", \"space\": " << param.space;
+            
+            if (param.type == cross_compiler::ROOT_PARAMETER_CONSTANTS)
+                out << ", \"num_constants\": " << param.num_constants;
+        }
         
-        std::string shader_extensions[] =
-        {
-            "_es2.glsl",
-            "_es3.glsl",
-            "_450.glsl",
-            "_vk.glsl",
-            ".hlsl",
-            ".metal"
-        };
+        out << " }" << (i + 1 < root_signature.parameters.size() ? ",\n" : "\n");
+    }
+    
+    out << "    ]\n";
+    out << "}\n";
+    
+    return write_file_atomic(output_file_path(output_path, file_name, "_rootsig.json"), out.str());
+}
+
+bool generate_and_write_root_signature(const std::vector<std::vector<unsigned int>>& stages, const cross_compiler::CompileOptions& compile_options, std::string output_path, std::string file_name)
+{
+    cross_compiler::RootSignature root_signature;
+    
+    if (!cross_compiler::generate_root_signature(stages, compile_options, root_signature))
+        return false;
+    
+    std::cout << "Root Signature (" << root_signature.dword_count << " DWORDs) : " << root_signature.hlsl << std::endl;
+    
+    return write_root_signature(root_signature, output_path, file_name);
+}
+
+bool write_binding_remap(const cross_compiler::BindingRemapTable& table, std::string write_path)
+{
+    std::ostringstream out;
+    
+    out << "{\n";
+    out << "    \"bindings\": [\n";
+    
+    for (size_t i = 0; i < table.bindings.size(); i++)
+    {
+        const cross_compiler::BindingRemap& remap = table.bindings[i];
         
-        spirv_compiler::ShaderStage stage;
-        cross_compiler::ShadingLanguage lang;
+        out << "        { \"name\": " << json_string(remap.name) << ", \"type\": \"" << kDescriptorTypeNames[remap.type]
+            << "\", \"set\": " << remap.set << ", \"binding\": " << remap.binding << ", \"combined\": " << (remap.combined ? "true" : "false")
+            << ", \"hlsl_register\": " << remap.hlsl_register << ", \"msl_index\": " << remap.msl_index;
         
-        if (shader_stage_map.find(shader_stage) == shader_stage_map.end())
-        {
-            printf("ERROR: Shader stage not specified!\n");
-            return 1;
-        }
-        else
-            stage = shader_stage_map[shader_stage];
+        if (remap.combined)
+            out << ", \"msl_sampler_index\": " << remap.msl_sampler_index;
         
-        if (target_lang_map.find(target_lang) == target_lang_map.end())
-        {
-            printf("ERROR: Target language not specified!\n");
-            return 1;
-        }
-        else
-            lang = target_lang_map[target_lang];
+        out << ", \"glsl_binding\": " << remap.glsl_binding << " }" << (i + 1 < table.bindings.size() ? ",\n" : "\n");
+    }
+    
+    out << "    ]\n";
+    out << "}\n";
+    
+    return write_file_atomic(write_path, out.str());
+}
 
-        if (spirv_compiler::compile(input_path, stage, spirv, is_vulkan_glsl))
-        {
-            std::string output_src;
+bool write_vertex_inputs(const std::vector<cross_compiler::VertexInput>& inputs, std::string write_path)
+{
+    std::ostringstream out;
+    
+    out << "{\n";
+    out << "    \"inputs\": [\n";
+    
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        const cross_compiler::VertexInput& input = inputs[i];
+        
+        out << "        { \"name\": " << json_string(input.name) << ", \"location\": " << input.location << ", \"locations\": " << input.locations
+            << ", \"components\": " << input.components << ", \"type\": " << json_string(input.type) << ", \"relaxed_precision\": " << (input.relaxed_precision ? "true" : "false")
+            << ", \"used\": " << (input.used ? "true" : "false") << ", \"format\": " << json_string(input.format) << " }" << (i + 1 < inputs.size() ? ",\n" : "\n");
+    }
+    
+    out << "    ]\n";
+    out << "}\n";
+    
+    return write_file_atomic(write_path, out.str());
+}
+
+bool cross_compile_and_write(const std::vector<unsigned int>& spirv, cross_compiler::ShadingLanguage lang, const cross_compiler::CompileOptions& compile_options, std::string output_path, std::string file_name, bool vertex_inputs)
+{
+    std::string output_src;
+    size_t unminified_size = 0;
+    spirv_transform::PrecisionReport precision_report;
+    precision_report.temporaries = 0;
+    
+    if (!cross_compiler::compile(spirv, lang, output_src, compile_options, &unminified_size, &precision_report))
+        return false;
+    
+    bool is_es = lang == cross_compiler::SHADING_LANGUAGE_GLSL_ES2 || lang == cross_compiler::SHADING_LANGUAGE_GLSL_ES3;
+    
+    if (compile_options.relax_precision && is_es)
+    {
+        // one write per line, as compile threads report at the same time in pipeline mode
+        std::string line = "Relaxed to mediump in " + file_name + " : " + std::to_string(precision_report.temporaries) + " temporaries";
+        
+        for (auto& variable : precision_report.variables)
+            line += ", " + variable;
+        
+        printf("%s\n", line.c_str());
+    }
+    
+    if (compile_options.minify)
+    {
+        std::cout << "Minified " << file_name << " : " << unminified_size << " -> " << output_src.size() << " bytes ("
+                  << int64_t(unminified_size) - int64_t(output_src.size()) << " saved)" << std::endl;
+    }
+    
+    if (!write_file_atomic(output_file_path(output_path, file_name, kShaderExtensions[lang]), std::move(output_src)))
+        return false;
+    
+    if (lang == cross_compiler::SHADING_LANGUAGE_MSL && compile_options.msl_argument_buffer_tier > 0)
+    {
+        cross_compiler::ArgumentBufferLayout layout;
+        
+        if (!cross_compiler::generate_argument_buffer_layout(spirv, compile_options, layout))
+            return false;
+        
+        if (!write_argument_buffer_layout(layout, output_file_path(output_path, file_name, "_argument_buffers.json")))
+            return false;
+    }
+    
+    std::vector<cross_compiler::VertexInput> inputs;
+    
+    // other stages have no vertex inputs to report
+    if (vertex_inputs && cross_compiler::reflect_vertex_inputs(spirv, inputs) &&
+        !write_vertex_inputs(inputs, output_file_path(output_path, file_name, "_vertex_inputs.json")))
+        return false;
+    
+    return true;
+}
+
+void print_varying_packing_report(const spirv_transform::VaryingPackingReport& report)
+{
+    std::cout << "Varying Slots : " << report.slots_before << " -> " << report.slots_after << std::endl;
+    
+    for (auto& varying : report.varyings)
+        std::cout << "\t" << varying.name << " (location " << varying.location << ") -> packed_varying_" << varying.slot << "." << varying.swizzle << std::endl;
+}
+
+const char* kShaderStageNames[] =
+{
+    "vertex",
+    "fragment",
+    "compute"
+};
+
+// Parses a comma separated list of shader stages. An empty string gives an empty list.
+bool parse_shader_stages(const std::string& arg, std::unordered_map<std::string, spirv_compiler::ShaderStage>& shader_stage_map, std::vector<spirv_compiler::ShaderStage>& stages)
+{
+    size_t start = 0;
+    
+    while (start < arg.size())
+    {
+        size_t end = arg.find(',', start);
+        std::string name = arg.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        
+        if (shader_stage_map.find(name) == shader_stage_map.end())
+            return false;
+        
+        stages.push_back(shader_stage_map[name]);
+        
+        if (end == std::string::npos)
+            break;
+        
+        start = end + 1;
+    }
+    
+    return true;
+}
 
-            if (cross_compiler::compile(spirv, lang, output_src))
+void print_interface_report(const spirv_transform::InterfaceReport& report)
+{
+    std::cout << "Dead Interface Variables : " << report.instructions_removed << " vertex instructions removed" << std::endl;
+    
+    for (auto& output : report.outputs)
+        std::cout << "\tOutput = " << output << std::endl;
+    
+    for (auto& input : report.inputs)
+        std::cout << "\tInput = " << input << std::endl;
+}
+
+// Parses "<stage>:<path>,..." into additional shader sources linked with the input shader.
+bool parse_linked_stages(const std::string& arg, std::unordered_map<std::string, spirv_compiler::ShaderStage>& shader_stage_map, std::vector<spirv_compiler::ShaderSource>& sources)
+{
+    size_t start = 0;
+    
+    while (start < arg.size())
+    {
+        size_t end = arg.find(',', start);
+        std::string entry = arg.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        size_t colon = entry.find(':');
+        
+        if (colon == std::string::npos || shader_stage_map.find(entry.substr(0, colon)) == shader_stage_map.end())
+            return false;
+        
+        sources.push_back({ entry.substr(colon + 1), shader_stage_map[entry.substr(0, colon)], {} });
+        
+        if (end == std::string::npos)
+            break;
+        
+        start = end + 1;
+    }
+    
+    return true;
+}
+
+void print_specialization_report(const std::vector<spirv_transform::SpecializationConstant>& constants, const spirv_transform::SpecializationReport& report)
+{
+    std::cout << "Specialization (";
+    
+    for (size_t i = 0; i < constants.size(); i++)
+        std::cout << (i > 0 ? ", " : "") << constants[i].constant_id << " = " << constants[i].value;
+    
+    std::cout << ") : " << report.constants_frozen << " constants frozen, " << report.instructions_folded << " instructions folded, "
+              << report.branches_eliminated << " branches eliminated, " << report.blocks_removed << " blocks removed" << std::endl;
+}
+
+// Parses "[<target>:]<x>,<y>,<z>;..." and picks the entry for 'target_lang', falling back to the
+// entry without a target. Dimensions left empty keep the size declared in the shader.
+bool parse_workgroup_size(const std::string& arg, const std::string& target_lang, uint32_t workgroup_size[3])
+{
+    bool matched = false;
+    size_t start = 0;
+    
+    while (start < arg.size())
+    {
+        size_t end = arg.find(';', start);
+        std::string entry = arg.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        size_t colon = entry.find(':');
+        std::string entry_lang = colon == std::string::npos ? "" : entry.substr(0, colon);
+        std::string dimensions = colon == std::string::npos ? entry : entry.substr(colon + 1);
+        
+        if (entry_lang == target_lang || (entry_lang == "" && !matched))
+        {
+            uint32_t size[3] = { 0, 0, 0 };
+            size_t pos = 0;
+            
+            for (uint32_t i = 0; i < 3 && pos <= dimensions.size(); i++)
             {
-                std::string write_path = output_path;
+                size_t comma = dimensions.find(',', pos);
+                std::string value = dimensions.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
                 
-                if (write_path == "")
-                    write_path = write_path + file_name;
-                else
+                if (value != "")
                 {
-                    write_path = write_path + "/";
-                    write_path = write_path + file_name;
+                    try
+                    {
+                        size[i] = uint32_t(std::stoul(value));
+                    }
+                    catch (const std::exception&)
+                    {
+                        return false;
+                    }
                 }
                 
-                write_path = write_path + shader_extensions[lang];
+                if (comma == std::string::npos)
+                    break;
                 
-                std::ofstream out(write_path);
-                out << output_src;
-                out.close();
-                
-                return 0;
+                pos = comma + 1;
             }
             
-            return 1;
+            std::copy(size, size + 3, workgroup_size);
+            matched = entry_lang == target_lang;
+        }
+        
+        if (end == std::string::npos)
+            break;
+        
+        start = end + 1;
+    }
+    
+    return true;
+}
+
+// Parses "<constant_id>:<value>,...;<constant_id>:<value>,..." into one list of values per variant.
+bool parse_specializations(const std::string& arg, std::vector<std::vector<spirv_transform::SpecializationConstant>>& variants)
+{
+    size_t start = 0;
+    
+    while (start <= arg.size())
+    {
+        size_t end = arg.find(';', start);
+        std::string variant_arg = arg.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        std::vector<spirv_transform::SpecializationConstant> variant;
+        size_t pos = 0;
+        
+        while (pos < variant_arg.size())
+        {
+            size_t comma = variant_arg.find(',', pos);
+            std::string pair = variant_arg.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+            size_t colon = pair.find(':');
+            
+            if (colon == std::string::npos || colon == 0 || colon + 1 == pair.size())
+                return false;
+            
+            std::string value = pair.substr(colon + 1);
+            spirv_transform::SpecializationConstant constant;
+            
+            try
+            {
+                constant.constant_id = uint32_t(std::stoul(pair.substr(0, colon)));
+                constant.value = value == "true" ? 1.0 : (value == "false" ? 0.0 : std::stod(value));
+            }
+            catch (const std::exception&)
+            {
+                return false;
+            }
+            
+            variant.push_back(constant);
+            
+            if (comma == std::string::npos)
+                break;
+            
+            pos = comma + 1;
         }
+        
+        variants.push_back(variant);
+        
+        if (end == std::string::npos)
+            break;
+        
+        start = end + 1;
     }
-    else
-        print_usage();
     
-    return 1;
+    return true;
+}
+
+struct CostColumn
+{
+    const char* name;
+    uint32_t spirv_transform::ShaderCost::* member;
+};
+
+const CostColumn kCostColumns[] =
+{
+    { "float_alu", &spirv_transform::ShaderCost::float_alu },
+    { "int_alu", &spirv_transform::ShaderCost::int_alu },
+    { "transcendental", &spirv_transform::ShaderCost::transcendental },
+    { "texture_samples", &spirv_transform::ShaderCost::texture_samples },
+    { "branches", &spirv_transform::ShaderCost::branches },
+    { "loops", &spirv_transform::ShaderCost::loops },
+    { "max_live_values", &spirv_transform::ShaderCost::max_live_values }
+};
+
+const size_t kCostColumnCount = sizeof(kCostColumns) / sizeof(kCostColumns[0]);
+
+struct ShaderCostEntry
+{
+    std::string shader;
+    spirv_transform::ShaderCost cost;
+};
+
+struct CostLimit
+{
+    size_t column;
+    uint32_t max_value;
+};
+
+int find_cost_column(const std::string& name)
+{
+    for (size_t i = 0; i < kCostColumnCount; i++)
+    {
+        if (name == kCostColumns[i].name)
+            return int(i);
+    }
+    
+    return -1;
+}
+
+// Parses "<column>:<max>,..." into the limits a shader must stay within.
+bool parse_cost_limits(const std::string& arg, std::vector<CostLimit>& limits)
+{
+    size_t start = 0;
+    
+    while (start < arg.size())
+    {
+        size_t end = arg.find(',', start);
+        std::string entry = arg.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        size_t colon = entry.find(':');
+        int column = colon == std::string::npos ? -1 : find_cost_column(entry.substr(0, colon));
+        
+        if (column < 0)
+            return false;
+        
+        try
+        {
+            limits.push_back({ size_t(column), uint32_t(std::stoul(entry.substr(colon + 1))) });
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+        
+        if (end == std::string::npos)
+            break;
+        
+        start = end + 1;
+    }
+    
+    return true;
+}
+
+bool analyze_shader_cost(const std::vector<unsigned int>& spirv, const std::string& shader, std::vector<ShaderCostEntry>& entries)
+{
+    std::vector<spirv_transform::ShaderCost> costs;
+    
+    if (!spirv_transform::analyze_cost(spirv, costs))
+        return false;
+    
+    for (auto& cost : costs)
+        entries.push_back({ shader, cost });
+    
+    return true;
+}
+
+std::string cost_report_header()
+{
+    std::string header = "shader,entry_point,target";
+    
+    for (size_t i = 0; i < kCostColumnCount; i++)
+        header += std::string(",") + kCostColumns[i].name;
+    
+    return header + "\n";
+}
+
+std::string cost_report_rows(const std::vector<ShaderCostEntry>& entries, const std::string& target_lang)
+{
+    std::string rows;
+    
+    for (auto& entry : entries)
+    {
+        rows += entry.shader + "," + entry.cost.entry_point + "," + target_lang;
+        
+        for (size_t i = 0; i < kCostColumnCount; i++)
+            rows += "," + std::to_string(entry.cost.*kCostColumns[i].member);
+        
+        rows += "\n";
+    }
+    
+    return rows;
+}
+
+// Where the compile of input 'index' writes its cost rows when several shaders are compiled
+// in one run. The driver merges them into the report in input order afterwards, so parallel
+// jobs neither race on the header nor interleave their rows.
+std::string cost_rows_path(const std::string& cost_report, size_t index)
+{
+    return cost_report + "." + std::to_string(index) + ".part";
+}
+
+// Reads and removes a file a job wrote for the driver, empty if the job failed before writing it.
+std::string take_part_file(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    
+    if (!in)
+        return "";
+    
+    std::stringstream contents;
+    contents << in.rdbuf();
+    in.close();
+    
+    std::remove(path.c_str());
+    
+    return contents.str();
+}
+
+// Replaces the report with the rows of this run, so rows of shaders that were renamed or
+// removed since the last run don't linger.
+void write_cost_report(const std::string& cost_report, const std::vector<std::string>& rows)
+{
+    std::string contents = cost_report_header();
+    
+    for (auto& input_rows : rows)
+        contents += input_rows;
+    
+    write_file_atomic(cost_report, std::move(contents));
+}
+
+// Merges the rows the compiles of 'inputs' wrote to their cost_rows_path into the report.
+void merge_cost_rows(const std::string& cost_report, const std::vector<std::string>& inputs)
+{
+    std::vector<std::string> rows;
+    
+    for (size_t i = 0; i < inputs.size(); i++)
+        rows.push_back(take_part_file(cost_rows_path(cost_report, i)));
+    
+    write_cost_report(cost_report, rows);
+}
+
+// The cost_rows_path of 'input', or an empty path when no report was asked for.
+std::string input_cost_rows_path(const std::string& cost_report, const std::vector<std::string>& inputs, const std::string& input)
+{
+    if (cost_report == "")
+        return "";
+    
+    return cost_rows_path(cost_report, size_t(std::find(inputs.begin(), inputs.end(), input) - inputs.begin()));
+}
+
+// Prints the costs sorted by 'sort_column' (most expensive first) and returns false if any
+// shader exceeds one of the limits.
+bool print_cost_report(std::vector<ShaderCostEntry>& entries, int sort_column, const std::vector<CostLimit>& limits)
+{
+    if (sort_column >= 0)
+    {
+        uint32_t spirv_transform::ShaderCost::* member = kCostColumns[sort_column].member;
+        
+        std::stable_sort(entries.begin(), entries.end(), [member](const ShaderCostEntry& a, const ShaderCostEntry& b) {
+            return a.cost.*member > b.cost.*member;
+        });
+    }
+    
+    bool within_limits = true;
+    
+    std::cout << "Shader Cost :" << std::endl;
+    
+    for (auto& entry : entries)
+    {
+        std::cout << "\t" << entry.shader << " (" << entry.cost.entry_point << ")";
+        
+        for (size_t i = 0; i < kCostColumnCount; i++)
+            std::cout << " " << kCostColumns[i].name << "=" << entry.cost.*kCostColumns[i].member;
+        
+        std::cout << std::endl;
+        
+        for (auto& limit : limits)
+        {
+            uint32_t value = entry.cost.*kCostColumns[limit.column].member;
+            
+            if (value > limit.max_value)
+            {
+                printf("ERROR: %s (%s) exceeds the %s limit (%u > %u)!\n", entry.shader.c_str(), entry.cost.entry_point.c_str(),
+                       kCostColumns[limit.column].name, value, limit.max_value);
+                within_limits = false;
+            }
+        }
+    }
+    
+    return within_limits;
+}
+
+// Sorted "NAME" or "NAME=VALUE" defines of one shader variant.
+typedef std::vector<std::string> DefineSet;
+
+enum VariantStatus
+{
+    VARIANT_STATUS_COMPILED,
+    VARIANT_STATUS_FAILED,
+    VARIANT_STATUS_MISSING
+};
+
+const char* kVariantStatusNames[] =
+{
+    "compiled",
+    "failed",
+    "missing"
+};
+
+struct ShaderVariant
+{
+    DefineSet defines;
+    std::string name;
+    bool used;  // found in the usage log
+    VariantStatus status;
+};
+
+// Splits a list of defines separated by spaces or commas.
+DefineSet parse_define_set(const std::string& text)
+{
+    DefineSet defines;
+    std::string define;
+    std::istringstream tokens(text);
+    
+    while (tokens >> define)
+    {
+        size_t start = 0;
+        
+        while (start < define.size())
+        {
+            size_t end = define.find(',', start);
+            std::string name = define.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            
+            if (!name.empty())
+                defines.push_back(name);
+            
+            if (end == std::string::npos)
+                break;
+            
+            start = end + 1;
+        }
+    }
+    
+    std::sort(defines.begin(), defines.end());
+    defines.erase(std::unique(defines.begin(), defines.end()), defines.end());
+    
+    return defines;
+}
+
+// Reads the define sets logged for 'shader_name' (the file name without extension) from lines
+// of the form "<shader_name>: DEFINE_A DEFINE_B=2", in the order they were first logged.
+bool read_usage_log(const std::string& path, const std::string& shader_name, std::vector<DefineSet>& sets)
+{
+    std::ifstream log(path);
+    
+    if (!log.is_open())
+    {
+        printf("ERROR: Failed to open %s\n", path.c_str());
+        return false;
+    }
+    
+    std::string line;
+    
+    while (std::getline(log, line))
+    {
+        size_t colon = line.find(':');
+        
+        if (line.empty() || line[0] == '#' || colon == std::string::npos)
+            continue;
+        
+        std::string name = line.substr(0, colon);
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t\r") + 1);
+        
+        if (name != shader_name)
+            continue;
+        
+        DefineSet defines = parse_define_set(line.substr(colon + 1));
+        
+        if (std::find(sets.begin(), sets.end(), defines) == sets.end())
+            sets.push_back(defines);
+    }
+    
+    return true;
+}
+
+// Every combination of the features being defined or not.
+bool expand_features(const std::vector<std::string>& features, std::vector<DefineSet>& sets)
+{
+    const size_t kMaxFeatures = 16;
+    
+    if (features.size() > kMaxFeatures)
+    {
+        printf("ERROR: At most %u features can be combined!\n", uint32_t(kMaxFeatures));
+        return false;
+    }
+    
+    for (uint32_t mask = 0; mask < (1u << features.size()); mask++)
+    {
+        DefineSet defines;
+        
+        for (size_t i = 0; i < features.size(); i++)
+        {
+            if (mask & (1u << i))
+                defines.push_back(features[i]);
+        }
+        
+        std::sort(defines.begin(), defines.end());
+        sets.push_back(defines);
+    }
+    
+    return true;
+}
+
+// The variant without defines keeps the shader's name, the others get a hash of their defines.
+std::string variant_name(const std::string& file_name, const DefineSet& defines)
+{
+    if (defines.empty())
+        return file_name;
+    
+    // FNV-1a, 64 bits so collisions stay unlikely across thousands of variants
+    uint64_t hash = 14695981039346656037ull;
+    
+    for (const std::string& define : defines)
+    {
+        for (char c : define + " ")
+            hash = (hash ^ uint8_t(c)) * 1099511628211ull;
+    }
+    
+    char suffix[24];
+    snprintf(suffix, sizeof(suffix), "_%016llx", (unsigned long long)hash);
+    
+    return file_name + suffix;
+}
+
+bool write_variant_manifest(const std::vector<ShaderVariant>& variants, std::string write_path)
+{
+    std::string out;
+    
+    out += "{\n";
+    out += "    \"variants\": [\n";
+    
+    for (size_t i = 0; i < variants.size(); i++)
+    {
+        const ShaderVariant& variant = variants[i];
+        
+        out += "        { \"name\": " + json_string(variant.name) + ", \"defines\": [";
+        
+        for (size_t j = 0; j < variant.defines.size(); j++)
+            out += std::string(j > 0 ? ", " : "") + json_string(variant.defines[j]);
+        
+        out += std::string("], \"used\": ") + (variant.used ? "true" : "false") + ", \"status\": \"" + kVariantStatusNames[variant.status] + "\" }";
+        out += i + 1 < variants.size() ? ",\n" : "\n";
+    }
+    
+    out += "    ]\n";
+    out += "}\n";
+    
+    return write_file_atomic(write_path, std::move(out));
+}
+
+// Compiles the define sets the usage log recorded for the shader first, then the remaining
+// combinations of 'features' at background priority, or skips them if 'compile_unused' is
+// false. <name>_variants.json lists every variant and whether it was compiled.
+bool compile_variants(const std::string& input_path, spirv_compiler::ShaderStage stage, cross_compiler::ShadingLanguage lang, const cross_compiler::CompileOptions& compile_options,
+                      bool vulkan_glsl, const std::vector<std::string>& features, const std::string& usage_log, bool compile_unused, const std::string& output_path, const std::string& file_name)
+{
+    std::vector<DefineSet> used_sets;
+    std::vector<DefineSet> all_sets;
+    
+    if (!read_usage_log(usage_log, file_name, used_sets) || !expand_features(features, all_sets))
+        return false;
+    
+    std::vector<ShaderVariant> variants;
+    
+    for (const DefineSet& defines : used_sets)
+        variants.push_back({ defines, variant_name(file_name, defines), true, VARIANT_STATUS_MISSING });
+    
+    for (const DefineSet& defines : all_sets)
+    {
+        if (std::find(used_sets.begin(), used_sets.end(), defines) == used_sets.end())
+            variants.push_back({ defines, variant_name(file_name, defines), false, VARIANT_STATUS_MISSING });
+    }
+    
+    // two define sets with the same name would overwrite each other's output
+    std::unordered_map<std::string, const ShaderVariant*> names;
+    
+    for (const ShaderVariant& variant : variants)
+    {
+        auto name = names.insert(std::make_pair(variant.name, &variant));
+        
+        if (!name.second && name.first->second->defines != variant.defines)
+        {
+            printf("ERROR: Variants of %s with different defines share the name %s!\n", file_name.c_str(), variant.name.c_str());
+            return false;
+        }
+    }
+    
+    if (!compile_queue::start(std::max(1u, std::thread::hardware_concurrency())))
+        return false;
+    
+    std::vector<std::future<compile_queue::CompileResult>> results(variants.size());
+    
+    for (size_t i = 0; i < variants.size(); i++)
+    {
+        if (!variants[i].used && !compile_unused)
+            continue;
+        
+        compile_queue::CompileRequest request;
+        request.path = input_path;
+        request.stage = stage;
+        request.lang = lang;
+        request.options = compile_options;
+        request.vulkan_glsl = vulkan_glsl;
+        request.defines = variants[i].defines;
+        request.priority = variants[i].used ? compile_queue::PRIORITY_NORMAL : compile_queue::PRIORITY_BACKGROUND;
+        
+        compile_queue::submit(request, results[i]);
+    }
+    
+    uint32_t compiled[2] = { 0, 0 };
+    bool success = true;
+    
+    for (size_t i = 0; i < variants.size(); i++)
+    {
+        if (!results[i].valid())
+            continue;
+        
+        compile_queue::CompileResult result = results[i].get();
+        ShaderVariant& variant = variants[i];
+        
+        if (result.status == compile_queue::JOB_STATUS_SUCCEEDED &&
+            write_file_atomic(output_file_path(output_path, variant.name, kShaderExtensions[lang]), std::move(result.source)))
+        {
+            variant.status = VARIANT_STATUS_COMPILED;
+            compiled[variant.used]++;
+        }
+        else
+        {
+            variant.status = VARIANT_STATUS_FAILED;
+            success = false;
+        }
+    }
+    
+    compile_queue::stop();
+    
+    uint32_t used_count = uint32_t(used_sets.size());
+    uint32_t missing = uint32_t(std::count_if(variants.begin(), variants.end(), [](const ShaderVariant& variant) {
+        return variant.status == VARIANT_STATUS_MISSING;
+    }));
+    
+    printf("Variants : %u of %u used compiled, %u of %u unused compiled, %u missing\n", compiled[1], used_count,
+           compiled[0], uint32_t(variants.size()) - used_count, missing);
+    
+    return write_variant_manifest(variants, output_file_path(output_path, file_name, "_variants.json")) && success;
+}
+
+void print_usage()
+{
+    printf("Usage: dwShaderCrossCompiler [option]... [input] [output_path]\n"
+           "\n"
+           "'input' is the GLSL shader source to be cross-compiled, or a SPIR-V binary (.spv)\n"
+           "which is cross-compiled directly and ignores --shader-stage and --vulkan-glsl.\n"
+           "'output_path' is the output path of the cross-compiled output.\n"
+           "\n"
+           "Options:\n"
+		   "  --vulkan-glsl					  Use this flag to indicate that the input is in Vulkan GLSL"
+           "  --shader-stage=<stage>          The shader stage corresponding to the input shader\n"
+           "                                  source (vertex, fragment or compute). A list such as\n"
+           "                                  'vertex,fragment' compiles every stage from the one source\n"
+           "                                  with VERTEX/FRAGMENT/COMPUTE defined and writes\n"
+           "                                  <name>_<stage> outputs. Without this option the stages are\n"
+           "                                  read from a '#pragma stages(vertex, fragment)' line.\n"
+           "  --target-language=<language>    Target shading language that the input shader source\n"
+           "                                  must be cross-compiled into (GLSL_ES2, GLSL_ES3, GLSL_450,\n"
+           "                                  GLSL_VK, HLSL or MSL).\n"
+           "  --strip-unused-resources        Only declare the resources and interface variables that\n"
+           "                                  the entry point actually uses.\n"
+           "  --strip-unused-members          Report unused uniform block members and remove the ones\n"
+           "                                  at the end of each block.\n"
+           "  --flatten-uniform-blocks        Emit each uniform block as a single vec4 array uniform so it\n"
+           "                                  can be uploaded with one call (GLSL_ES2, GLSL_ES3, GLSL_450).\n"
+           "  --fragment-precision=<precision> Default float precision of GLSL ES fragment shaders\n"
+           "                                  (lowp, mediump or highp).\n"
+           "  --vertex-precision=<precision>  Default float and int precision of GLSL ES vertex shaders\n"
+           "                                  (lowp, mediump or highp).\n"
+           "  --relax-precision               Mark values that only feed color outputs or texture\n"
+           "                                  coordinates as mediump in GLSL ES outputs.\n"
+           "  --native-16bit-types            Keep float16_t/int16_t types native in the output (HLSL\n"
+           "                                  shader model 6.2, MSL half, Vulkan GLSL 16-bit storage).\n"
+           "  --msl-argument-buffers=<tier>   Group each descriptor set into a Metal argument buffer (tier 1\n"
+           "                                  or 2) and write the resource index map next to the output.\n"
+           "  --root-signature                Write a D3D12 root signature for the HLSL output (for both\n"
+           "                                  shaders when used with --pack-varyings).\n"
+           "  --remap-bindings                Assign dense, deterministic HLSL registers, MSL indices and GLSL\n"
+           "                                  bindings from the set/binding pairs of all compiled stages and\n"
+           "                                  write the table to <name>_bindings.json.\n"
+           "  --specialize=<values>           Bake specialization constants into the SPIR-V and write one\n"
+           "                                  constant-folded output per value set (<name>_spec<n>). Value\n"
+           "                                  sets are separated by ';', e.g. \"0:1,1:2.5;0:0,1:1.0\".\n"
+           "                                  Linked and multi-stage inputs get the variants per stage.\n"
+           "  --workgroup-size=<sizes>        Override the local size of a compute shader as x,y,z. Per-target\n"
+           "                                  sizes can be given as e.g. \"HLSL:64,1,1;MSL:32,1,1;8,8,1\",\n"
+           "                                  where the entry without a target is the fallback.\n"
+           "  --input-list=<file>             Compile every shader listed in the file (one path per line) in\n"
+           "                                  worker processes, with the same options. 'output_path' is the\n"
+           "                                  only positional argument in this mode.\n"
+           "  --workers=<count>               Number of worker processes for --input-list, or threads for\n"
+           "                                  --pipeline and --scan-deps (default: one per hardware thread).\n"
+           "  --pipeline                      Compile the --input-list shaders on threads in this process,\n"
+           "                                  reading upcoming sources and writing finished outputs in the\n"
+           "                                  background while others compile.\n"
+           "  --job-timeout=<seconds>         Kill and restart workers that spend longer on one shader.\n"
+           "  --job-memory-limit=<MB>         Kill and restart workers whose resident memory exceeds this.\n"
+           "  --compile-history=<file>        Record each shader's glslang and cross-compile time for these\n"
+           "                                  options in the file and schedule --input-list jobs longest\n"
+           "                                  expected first. Shaders without history are estimated from\n"
+           "                                  their size.\n"
+           "  --scan-deps=<file>              Only preprocess the input (or every shader in --input-list) and\n"
+           "                                  write each shader's resolved includes and preprocessed text\n"
+           "                                  hash to the given JSON file.\n"
+           "  --watch                         Keep running and recompile the input (or the shaders in\n"
+           "                                  --input-list) whenever they or their includes change.\n"
+           "  --watch-debounce=<ms>           Wait for this long without further changes before\n"
+           "                                  recompiling in --watch mode (default: 30).\n"
+           "  --link=<stage>:<path>,...       Compile and link the given shaders together with 'input' as one\n"
+           "                                  program. Vertex outputs the fragment shader never reads are\n"
+           "                                  removed along with the code that only computes them. Each\n"
+           "                                  stage is written as <name>_<stage>, e.g. foo_vertex.\n"
+           "  --minify                        Strip whitespace and comments, shorten local identifiers and\n"
+           "                                  fold redundant parentheses in GLSL_ES2, GLSL_ES3 and MSL\n"
+           "                                  outputs. Resource and interface names are kept.\n"
+           "  --usage-log=<file>              Compile the define sets logged for this shader first, from\n"
+           "                                  lines of the form \"<name>: DEFINE_A DEFINE_B=2\", where <name>\n"
+           "                                  is the file name without extension. Variants are written as\n"
+           "                                  <name>_<hash> and listed in <name>_variants.json.\n"
+           "  --features=<A,B,...>            Features whose on/off combinations make up every variant.\n"
+           "  --unused-variants=<mode>        'skip' (default) lists the unlogged combinations as missing in\n"
+           "                                  the manifest, 'compile' compiles them at background priority.\n"
+           "  --vertex-inputs                 Write <name>_vertex_inputs.json for vertex shaders, listing each\n"
+           "                                  input's location, type, whether it's read and a recommended\n"
+           "                                  packed vertex format.\n"
+           "  --cost-analysis                 Print the estimated ALU, transcendental, texture, branch, loop\n"
+           "                                  and live value counts of every compiled entry point.\n"
+           "  --cost-sort=<column>            Sort the cost analysis by the given column, most expensive\n"
+           "                                  first (float_alu, int_alu, transcendental, texture_samples,\n"
+           "                                  branches, loops or max_live_values).\n"
+           "  --cost-report=<csv>             Write the cost analysis rows to the given CSV file. With\n"
+           "                                  --input-list it holds the rows of every listed shader.\n"
+           "  --cost-limits=<column>:<max>,... Fail if any entry point exceeds one of the given limits.\n"
+           "  --allocation-stats              Print the number and size of the allocations made by each\n"
+           "                                  compile stage.\n"
+           "  --include-cache-stats           Print the hits and misses of the source and include cache\n"
+           "                                  after the run (also with --input-list and --watch).\n"
+           "  --pack-varyings=<fragment>      Compile 'input' as the vertex shader together with the given\n"
+           "                                  fragment shader and pack their float/vec2/vec3 varyings into\n"
+           "                                  shared vec4 slots. Intended for the GLSL_ES2/GLSL_ES3 targets.\n"
+           );
+}
+
+// Seconds the calling thread spent in the GLSL frontend since compile_input started, which
+// the compile history keeps apart from the cross-compile time of each target.
+thread_local double t_FrontendSeconds = 0.0;
+
+template <typename Function>
+bool time_frontend(Function compile)
+{
+    auto start = std::chrono::steady_clock::now();
+    bool compiled = compile();
+    t_FrontendSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    return compiled;
+}
+
+int compile_shader(int argc, char* argv[])
+{
+    ArgumentParser parser;
+    
+	parser.add_bool_option("vulkan-glsl");
+    parser.add_option("shader-stage");
+    parser.add_option("target-language");
+    parser.add_bool_option("strip-unused-resources");
+    parser.add_bool_option("strip-unused-members");
+    parser.add_bool_option("flatten-uniform-blocks");
+    parser.add_option("fragment-precision");
+    parser.add_option("vertex-precision");
+    parser.add_bool_option("relax-precision");
+    parser.add_bool_option("native-16bit-types");
+    parser.add_option("msl-argument-buffers");
+    parser.add_bool_option("root-signature");
+    parser.add_bool_option("remap-bindings");
+    parser.add_option("specialize");
+    parser.add_option("workgroup-size");
+    parser.add_option("pack-varyings");
+    parser.add_option("link");
+    parser.add_bool_option("minify");
+    parser.add_bool_option("vertex-inputs");
+    parser.add_option("usage-log");
+    parser.add_option("features");
+    parser.add_option("unused-variants");
+    parser.add_bool_option("cost-analysis");
+    parser.add_option("cost-sort");
+    parser.add_option("cost-report");
+    parser.add_option("cost-rows");
+    parser.add_option("cost-limits");
+    parser.add_bool_option("allocation-stats");
+
+    if (argc > 1)
+    {
+        parser.parse(argc, argv);
+        
+        std::vector<unsigned int> spirv;
+    
+        std::string input_path = parser.ordered_argument(0);
+        std::string output_path = parser.ordered_argument(1);
+        std::string shader_stage = parser.argument("shader-stage");
+        std::string target_lang = parser.argument("target-language");
+		bool is_vulkan_glsl = parser.bool_argument("vulkan-glsl");
+        std::string pack_varyings_path = parser.argument("pack-varyings");
+        bool remap_bindings = parser.bool_argument("remap-bindings");
+        bool vertex_inputs = parser.bool_argument("vertex-inputs");
+        std::string specialize = parser.argument("specialize");
+        cross_compiler::BindingRemapTable binding_remap;
+        
+        cross_compiler::CompileOptions compile_options;
+        compile_options.strip_unused_resources = parser.bool_argument("strip-unused-resources");
+        compile_options.strip_unused_members = parser.bool_argument("strip-unused-members");
+        compile_options.flatten_uniform_blocks = parser.bool_argument("flatten-uniform-blocks");
+        compile_options.relax_precision = parser.bool_argument("relax-precision");
+        compile_options.native_16bit_types = parser.bool_argument("native-16bit-types");
+        compile_options.hlsl_root_signature = parser.bool_argument("root-signature");
+        compile_options.minify = parser.bool_argument("minify");
+        
+        std::string argument_buffer_tier = parser.argument("msl-argument-buffers");
+        
+        if (argument_buffer_tier == "1" || argument_buffer_tier == "2")
+            compile_options.msl_argument_buffer_tier = std::stoi(argument_buffer_tier);
+        else if (argument_buffer_tier != "")
+        {
+            printf("ERROR: Invalid argument buffer tier specified!\n");
+            return 1;
+        }
+        
+        std::unordered_map<std::string, cross_compiler::Precision> precision_map =
+        {
+            { "", cross_compiler::PRECISION_DEFAULT },
+            { "lowp", cross_compiler::PRECISION_LOWP },
+            { "mediump", cross_compiler::PRECISION_MEDIUMP },
+            { "highp", cross_compiler::PRECISION_HIGHP }
+        };
+        
+        std::string fragment_precision = parser.argument("fragment-precision");
+        std::string vertex_precision = parser.argument("vertex-precision");
+        
+        if (precision_map.find(fragment_precision) == precision_map.end() || precision_map.find(vertex_precision) == precision_map.end())
+        {
+            printf("ERROR: Invalid precision specified!\n");
+            return 1;
+        }
+        
+        compile_options.fragment_precision = precision_map[fragment_precision];
+        compile_options.vertex_precision = precision_map[vertex_precision];
+        
+        std::vector<std::vector<spirv_transform::SpecializationConstant>> specializations;
+        
+        if (specialize != "" && !parse_specializations(specialize, specializations))
+        {
+            printf("ERROR: Invalid specialization constant values specified!\n");
+            return 1;
+        }
+        
+        if (output_path == "")
+            output_path = path_without_file(input_path);
+        
+        std::string file_name = file_name_from_path(input_path);
+  
+        std::unordered_map<std::string, spirv_compiler::ShaderStage> shader_stage_map =
+        {
+            { "vertex", spirv_compiler::SHADER_STAGE_VERTEX },
+            { "fragment", spirv_compiler::SHADER_STAGE_FRAGMENT },
+            { "compute", spirv_compiler::SHADER_STAGE_COMPUTE }
+        };
+        
+        std::unordered_map<std::string, cross_compiler::ShadingLanguage> target_lang_map =
+        {
+            { "GLSL_ES2", cross_compiler::SHADING_LANGUAGE_GLSL_ES2 },
+            { "GLSL_ES3", cross_compiler::SHADING_LANGUAGE_GLSL_ES3 },
+            { "GLSL_450", cross_compiler::SHADING_LANGUAGE_GLSL_450 },
+            { "GLSL_VK", cross_compiler::SHADING_LANGUAGE_GLSL_VK },
+            { "HLSL", cross_compiler::SHADING_LANGUAGE_HLSL },
+            { "MSL", cross_compiler::SHADING_LANGUAGE_MSL }
+        };
+        
+        std::vector<spirv_compiler::ShaderStage> input_stages;
+        cross_compiler::ShadingLanguage lang;
+        
+        // SPIR-V input carries its own stage and skips the GLSL frontend
+        bool spirv_input = input_path.size() > 4 && input_path.compare(input_path.size() - 4, 4, ".spv") == 0;
+        
+        if (spirv_input && (parser.argument("link") != "" || pack_varyings_path != ""))
+        {
+            printf("ERROR: --link and --pack-varyings require GLSL input!\n");
+            return 1;
+        }
+        
+        // no stage means the stages come from a '#pragma stages(...)' line in the source
+        if (!spirv_input && !parse_shader_stages(shader_stage, shader_stage_map, input_stages))
+        {
+            printf("ERROR: Invalid shader stage specified!\n");
+            return 1;
+        }
+        
+        if (target_lang_map.find(target_lang) == target_lang_map.end())
+        {
+            printf("ERROR: Target language not specified!\n");
+            return 1;
+        }
+        else
+            lang = target_lang_map[target_lang];
+        
+        if (!parse_workgroup_size(parser.argument("workgroup-size"), target_lang, compile_options.workgroup_size))
+        {
+            printf("ERROR: Invalid workgroup size specified!\n");
+            return 1;
+        }
+        
+        std::string usage_log = parser.argument("usage-log");
+        std::string unused_variants = parser.argument("unused-variants");
+        
+        if (usage_log != "")
+        {
+            if (spirv_input || input_stages.size() != 1 || parser.argument("link") != "" || pack_varyings_path != "")
+            {
+                printf("ERROR: --usage-log requires a single stage GLSL input!\n");
+                return 1;
+            }
+            
+            if (unused_variants != "" && unused_variants != "compile" && unused_variants != "skip")
+            {
+                printf("ERROR: Invalid unused variant mode specified!\n");
+                return 1;
+            }
+            
+            std::vector<std::string> features = parse_define_set(parser.argument("features"));
+            
+            return compile_variants(input_path, input_stages[0], lang, compile_options, is_vulkan_glsl, features, usage_log,
+                                    unused_variants == "compile", output_path, file_name) ? 0 : 1;
+        }
+
+        std::string cost_report = parser.argument("cost-report");
+        std::string cost_rows = parser.argument("cost-rows");  // set by the drivers of --input-list and --watch
+        std::string cost_sort = parser.argument("cost-sort");
+        int cost_sort_column = find_cost_column(cost_sort);
+        std::vector<CostLimit> cost_limits;
+        std::vector<ShaderCostEntry> cost_entries;
+        
+        if ((cost_sort != "" && cost_sort_column < 0) || !parse_cost_limits(parser.argument("cost-limits"), cost_limits))
+        {
+            printf("ERROR: Invalid cost analysis column specified!\n");
+            return 1;
+        }
+        
+        bool analyze_cost = parser.bool_argument("cost-analysis") || cost_report != "" || cost_rows != "" || !cost_limits.empty();
+        
+        auto finish_cost_analysis = [&]()
+        {
+            if (!analyze_cost)
+                return true;
+            
+            if (cost_rows != "")
+                write_file_atomic(cost_rows, cost_report_rows(cost_entries, target_lang));
+            else if (cost_report != "")
+                write_cost_report(cost_report, { cost_report_rows(cost_entries, target_lang) });
+            
+            return print_cost_report(cost_entries, cost_sort_column, cost_limits);
+        };
+        
+        // cross compiles one stage, or one output per --specialize variant of it
+        auto write_stage = [&](const std::vector<unsigned int>& stage_spirv, const std::string& name)
+        {
+            for (size_t i = 0; i < specializations.size(); i++)
+            {
+                std::vector<unsigned int> specialized_spirv = stage_spirv;
+                spirv_transform::SpecializationReport report;
+                
+                if (!spirv_transform::specialize_constants(specialized_spirv, specializations[i], report))
+                    return false;
+                
+                print_specialization_report(specializations[i], report);
+                
+                std::string variant_name = name + "_spec" + std::to_string(i);
+                
+                if (!cross_compile_and_write(specialized_spirv, lang, compile_options, output_path, variant_name, vertex_inputs))
+                    return false;
+                
+                if (analyze_cost && !analyze_shader_cost(specialized_spirv, variant_name, cost_entries))
+                    return false;
+            }
+            
+            if (specializations.empty())
+            {
+                if (!cross_compile_and_write(stage_spirv, lang, compile_options, output_path, name, vertex_inputs))
+                    return false;
+                
+                if (analyze_cost && !analyze_shader_cost(stage_spirv, name, cost_entries))
+                    return false;
+            }
+            
+            return true;
+        };
+
+        std::vector<spirv_compiler::ShaderStage> program_stages;
+        std::vector<std::string> output_names;
+        std::vector<std::vector<unsigned int>> stages;
+        
+        if (!spirv_input && input_stages.size() != 1)
+        {
+            if (parser.argument("link") != "" || pack_varyings_path != "")
+            {
+                printf("ERROR: --link and --pack-varyings require a single shader stage input!\n");
+                return 1;
+            }
+            
+            if (!time_frontend([&]() { return spirv_compiler::compile_stages(input_path, input_stages, stages, is_vulkan_glsl, compile_options.native_16bit_types); }))
+                return 1;
+            
+            program_stages = input_stages;
+            
+            for (spirv_compiler::ShaderStage program_stage : program_stages)
+                output_names.push_back(file_name + "_" + kShaderStageNames[program_stage]);
+        }
+        else if (!spirv_input)
+        {
+            std::vector<spirv_compiler::ShaderSource> sources = { { input_path, input_stages[0], {} } };
+            
+            if (!parse_linked_stages(parser.argument("link"), shader_stage_map, sources))
+            {
+                printf("ERROR: Invalid linked shader stages specified!\n");
+                return 1;
+            }
+            
+            if (pack_varyings_path != "")
+            {
+                if (input_stages[0] != spirv_compiler::SHADER_STAGE_VERTEX)
+                {
+                    printf("ERROR: --pack-varyings requires a vertex shader input!\n");
+                    return 1;
+                }
+                
+                sources.push_back({ pack_varyings_path, spirv_compiler::SHADER_STAGE_FRAGMENT, {} });
+            }
+            
+            if (sources.size() > 1)
+            {
+                if (!time_frontend([&]() { return spirv_compiler::compile_program(sources, stages, is_vulkan_glsl, compile_options.native_16bit_types); }))
+                    return 1;
+                
+                for (const spirv_compiler::ShaderSource& source : sources)
+                {
+                    program_stages.push_back(source.stage);
+                    // sources of different stages often share a name, e.g. foo.vert and foo.frag
+                    output_names.push_back(file_name_from_path(source.path) + "_" + kShaderStageNames[source.stage]);
+                }
+            }
+        }
+        
+        if (program_stages.size() > 0)
+        {
+            auto find_stage = [&program_stages](spirv_compiler::ShaderStage program_stage)
+            {
+                auto it = std::find(program_stages.begin(), program_stages.end(), program_stage);
+                return it == program_stages.end() ? -1 : int(it - program_stages.begin());
+            };
+            
+            int vertex = find_stage(spirv_compiler::SHADER_STAGE_VERTEX);
+            int fragment = find_stage(spirv_compiler::SHADER_STAGE_FRAGMENT);
+            
+            if (vertex >= 0 && fragment >= 0)
+            {
+                spirv_transform::InterfaceReport interface_report;
+                
+                if (!spirv_transform::eliminate_dead_varyings(stages[vertex], stages[fragment], interface_report))
+                    return 1;
+                
+                print_interface_report(interface_report);
+                
+                if (pack_varyings_path != "")
+                {
+                    spirv_transform::VaryingPackingReport report;
+                    
+                    if (!spirv_transform::pack_varyings(stages[vertex], stages[fragment], report))
+                        return 1;
+                    
+                    print_varying_packing_report(report);
+                }
+            }
+            
+            if (remap_bindings)
+            {
+                if (!cross_compiler::generate_binding_remap(stages, compile_options, binding_remap))
+                    return 1;
+                
+                if (!write_binding_remap(binding_remap, output_file_path(output_path, file_name, "_bindings.json")))
+                    return 1;
+                
+                compile_options.binding_remap = &binding_remap;
+            }
+            
+            for (size_t i = 0; i < stages.size(); i++)
+            {
+                if (!write_stage(stages[i], output_names[i]))
+                    return 1;
+            }
+            
+            if (lang == cross_compiler::SHADING_LANGUAGE_HLSL && compile_options.hlsl_root_signature &&
+                !generate_and_write_root_signature(stages, compile_options, output_path, file_name))
+                return 1;
+            
+            return finish_cost_analysis() ? 0 : 1;
+        }
+        
+        bool compiled = false;
+        
+        if (spirv_input)
+            compiled = spirv_transform::load_module(input_path, spirv);
+        else
+            compiled = time_frontend([&]() { return spirv_compiler::compile(input_path, input_stages[0], spirv, is_vulkan_glsl, compile_options.native_16bit_types); });
+
+        if (compiled)
+        {
+            if (remap_bindings)
+            {
+                if (!cross_compiler::generate_binding_remap({ spirv }, compile_options, binding_remap))
+                    return 1;
+                
+                if (!write_binding_remap(binding_remap, output_file_path(output_path, file_name, "_bindings.json")))
+                    return 1;
+                
+                compile_options.binding_remap = &binding_remap;
+            }
+            
+            if (!write_stage(spirv, file_name))
+                return 1;
+            
+            if (lang == cross_compiler::SHADING_LANGUAGE_HLSL && compile_options.hlsl_root_signature &&
+                !generate_and_write_root_signature({ spirv }, compile_options, output_path, file_name))
+                return 1;
+            
+            return finish_cost_analysis() ? 0 : 1;
+        }
+    }
+    else
+        print_usage();
+    
+    return 1;
+}
+
+// Reads one path per line, skipping empty lines.
+bool read_input_list(const std::string& input_list, std::vector<std::string>& inputs)
+{
+    std::ifstream list(input_list);
+    
+    if (!list.is_open())
+    {
+        printf("ERROR: Failed to open %s\n", input_list.c_str());
+        return false;
+    }
+    
+    std::string line;
+    
+    while (std::getline(list, line))
+    {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+            line.pop_back();
+        
+        if (!line.empty())
+            inputs.push_back(line);
+    }
+    
+    return true;
+}
+
+bool write_dependencies(const std::vector<spirv_compiler::ShaderDependencies>& dependencies, std::string write_path)
+{
+    std::ostringstream out;
+    
+    out << "{\n";
+    out << "    \"shaders\": [\n";
+    
+    for (size_t i = 0; i < dependencies.size(); i++)
+    {
+        const spirv_compiler::ShaderDependencies& shader = dependencies[i];
+        char hash[17];
+        snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)shader.hash);
+        
+        out << "        { \"path\": " << json_string(shader.path) << ", \"hash\": \"" << hash << "\", \"includes\": [";
+        
+        for (size_t j = 0; j < shader.includes.size(); j++)
+            out << (j > 0 ? ", " : "") << json_string(shader.includes[j]);
+        
+        out << "] }" << (i + 1 < dependencies.size() ? ",\n" : "\n");
+    }
+    
+    out << "    ]\n";
+    out << "}\n";
+    
+    return write_file_atomic(write_path, out.str());
+}
+
+// Collects the input, or every shader in --input-list, along with the --shader-stage list.
+bool gather_inputs(ArgumentParser& parser, std::vector<std::string>& inputs, std::vector<spirv_compiler::ShaderStage>& stages)
+{
+    std::unordered_map<std::string, spirv_compiler::ShaderStage> shader_stage_map =
+    {
+        { "vertex", spirv_compiler::SHADER_STAGE_VERTEX },
+        { "fragment", spirv_compiler::SHADER_STAGE_FRAGMENT },
+        { "compute", spirv_compiler::SHADER_STAGE_COMPUTE }
+    };
+    
+    if (parser.argument("input-list") != "")
+    {
+        if (!read_input_list(parser.argument("input-list"), inputs))
+            return false;
+    }
+    else if (parser.ordered_argument(0) != "")
+        inputs.push_back(parser.ordered_argument(0));
+    
+    if (!parse_shader_stages(parser.argument("shader-stage"), shader_stage_map, stages))
+    {
+        printf("ERROR: Invalid shader stage specified!\n");
+        return false;
+    }
+    
+    return true;
+}
+
+// Preprocesses the input (or every shader in --input-list) and writes their include lists
+// and preprocessed text hashes, without compiling anything.
+int scan_dependencies(ArgumentParser& parser, const std::string& write_path, uint32_t thread_count)
+{
+    std::vector<std::string> inputs;
+    std::vector<spirv_compiler::ShaderStage> stages;
+    
+    if (!gather_inputs(parser, inputs, stages))
+        return 1;
+    
+    std::vector<spirv_compiler::ShaderDependencies> dependencies;
+    bool success = spirv_compiler::scan_dependencies(inputs, stages, dependencies, thread_count, parser.bool_argument("vulkan-glsl"),
+                                                     parser.bool_argument("native-16bit-types"));
+    
+    // failed shaders are left out, so the build system recompiles them to report the errors
+    dependencies.erase(std::remove_if(dependencies.begin(), dependencies.end(), [](const spirv_compiler::ShaderDependencies& shader) {
+        return !shader.success;
+    }), dependencies.end());
+    
+    if (!write_dependencies(dependencies, write_path))
+        return 1;
+    
+    return success ? 0 : 1;
+}
+
+// Runs compile_shader for 'input' with the options given on the command line. A non-empty
+// 'cost_rows' takes the place of --cost-report (see cost_rows_path). 'frontend_seconds'
+// receives the part of the compile spent in glslang.
+int compile_input(int argc, char* argv[], const std::string& input, const std::string& output_path, const std::string& cost_rows, double* frontend_seconds = nullptr)
+{
+    std::vector<std::string> args = { argv[0] };
+    
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-' || argv[i][1] != '-')
+            continue;
+        
+        if (cost_rows != "" && strncmp(argv[i], "--cost-report=", 14) == 0)
+            args.push_back("--cost-rows=" + cost_rows);
+        else
+            args.push_back(argv[i]);
+    }
+    
+    args.push_back(input);
+    
+    if (output_path != "")
+        args.push_back(output_path);
+    
+    std::vector<char*> job_argv;
+    
+    for (std::string& arg : args)
+        job_argv.push_back(&arg[0]);
+    
+    t_FrontendSeconds = 0.0;
+    int result = compile_shader(int(job_argv.size()), job_argv.data());
+    
+    if (frontend_seconds)
+        *frontend_seconds = t_FrontendSeconds;
+    
+    return result;
+}
+
+void print_include_cache_stats(const spirv_compiler::IncludeCacheStats& stats)
+{
+    printf("Include cache: %llu hits, %llu misses, %llu bytes read, %llu files\n", (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+           (unsigned long long)stats.bytes_read, (unsigned long long)stats.files);
+}
+
+// Compiles the inputs, then recompiles the ones affected by every change to them or to the
+// files they include, until the process is interrupted.
+int watch_shaders(int argc, char* argv[], ArgumentParser& parser, uint32_t debounce_ms)
+{
+    std::vector<std::string> inputs;
+    std::vector<spirv_compiler::ShaderStage> stages;
+    std::string output_path = parser.argument("input-list") != "" ? parser.ordered_argument(0) : parser.ordered_argument(1);
+    
+    if (!gather_inputs(parser, inputs, stages))
+        return 1;
+    
+    file_watcher::Watcher* watcher = file_watcher::create_watcher();
+    
+    if (watcher == nullptr)
+        return 1;
+    
+    // keep glslang's built-in symbol tables around between recompiles
+    spirv_compiler::initialize();
+    
+    std::string cost_report = parser.argument("cost-report");
+    std::vector<std::string> cost_rows(inputs.size());  // latest rows of every input
+    
+    std::unordered_map<std::string, std::vector<std::string>> dependencies;  // input -> itself and its includes
+    std::vector<std::string> dirty = inputs;
+    
+    while (true)
+    {
+        auto start = std::chrono::steady_clock::now();
+        
+        for (const std::string& input : dirty)
+        {
+            std::string rows_path = input_cost_rows_path(cost_report, inputs, input);
+            compile_input(argc, argv, input, output_path, rows_path);
+            
+            if (rows_path != "")
+                cost_rows[std::find(inputs.begin(), inputs.end(), input) - inputs.begin()] = take_part_file(rows_path);
+        }
+        
+        if (cost_report != "")
+            write_cost_report(cost_report, cost_rows);
+        
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("Recompiled %u shader(s) in %.1f ms\n", uint32_t(dirty.size()), milliseconds);
+        
+        if (parser.bool_argument("include-cache-stats"))
+        {
+            spirv_compiler::IncludeCacheStats stats;
+            spirv_compiler::include_cache_stats(stats);
+            print_include_cache_stats(stats);
+        }
+        
+        fflush(stdout);
+        
+        // the include trees may have changed along with the sources
+        std::vector<spirv_compiler::ShaderDependencies> scanned;
+        spirv_compiler::scan_dependencies(dirty, stages, scanned, 0, parser.bool_argument("vulkan-glsl"), parser.bool_argument("native-16bit-types"));
+        
+        for (const spirv_compiler::ShaderDependencies& shader : scanned)
+        {
+            std::vector<std::string>& files = dependencies[shader.path];
+            
+            // keep watching the old includes of shaders that fail to preprocess
+            if (!shader.success && !files.empty())
+                continue;
+            
+            files = { shader.path };
+            files.insert(files.end(), shader.includes.begin(), shader.includes.end());
+        }
+        
+        std::set<std::string> watched;
+        
+        for (auto& input : dependencies)
+            watched.insert(input.second.begin(), input.second.end());
+        
+        std::vector<std::string> changed;
+        
+        if (!file_watcher::watch_files(watcher, std::vector<std::string>(watched.begin(), watched.end())) ||
+            !file_watcher::wait_for_changes(watcher, debounce_ms, changed))
+            break;
+        
+        dirty.clear();
+        
+        for (const std::string& input : inputs)
+        {
+            const std::vector<std::string>& files = dependencies[input];
+            
+            bool affected = std::any_of(files.begin(), files.end(), [&changed](const std::string& file) {
+                return std::binary_search(changed.begin(), changed.end(), file);
+            });
+            
+            if (affected)
+                dirty.push_back(input);
+        }
+    }
+    
+    spirv_compiler::finalize();
+    file_watcher::destroy_watcher(watcher);
+    
+    return 1;
+}
+
+// Measured compile times of previous runs in seconds, keyed by shader path and options.
+typedef std::unordered_map<std::string, double> CompileHistory;
+
+// Seconds per byte of source assumed for shaders without history when nothing is known yet.
+const double kDefaultFrontendSecondsPerByte = 1e-6;
+const double kDefaultCrossCompileSecondsPerByte = 1e-6;
+
+void read_compile_history(const std::string& path, CompileHistory& history)
+{
+    std::ifstream in(path);
+    std::string line;
+    
+    while (std::getline(in, line))
+    {
+        size_t tab = line.find('\t');
+        
+        if (tab == std::string::npos)
+            continue;
+        
+        try
+        {
+            history[line.substr(tab + 1)] = std::stod(line.substr(0, tab));
+        }
+        catch (const std::exception&)
+        {
+        }
+    }
+}
+
+void write_compile_history(const std::string& path, const CompileHistory& history)
+{
+    std::vector<std::pair<std::string, double>> entries(history.begin(), history.end());
+    std::sort(entries.begin(), entries.end());
+    
+    std::string contents;
+    char seconds[32];
+    
+    for (auto& entry : entries)
+    {
+        snprintf(seconds, sizeof(seconds), "%.6f", entry.second);
+        contents += std::string(seconds) + "\t" + entry.first + "\n";
+    }
+    
+    write_file_atomic(path, std::move(contents));
+}
+
+// Options that don't change the outputs of a shader, only how the list is run or reported.
+const char* kNonOutputOptions[] =
+{
+    "--input-list", "--workers", "--job-timeout", "--job-memory-limit", "--compile-history", "--pipeline",
+    "--allocation-stats", "--include-cache-stats", "--watch", "--watch-debounce", "--scan-deps", "--cost-analysis", "--cost-sort",
+    "--cost-report", "--cost-limits"
+};
+
+// Options read by the GLSL frontend, so a shader's glslang time is shared by every target it's
+// cross-compiled to.
+const char* kFrontendOptions[] =
+{
+    "--shader-stage", "--vulkan-glsl", "--native-16bit-types", "--link", "--pack-varyings", "--usage-log", "--features",
+    "--unused-variants"
+};
+
+bool option_in(const std::string& arg, const char* const* begin, const char* const* end)
+{
+    return std::any_of(begin, end, [&arg](const char* option) {
+        return arg.compare(0, strlen(option), option) == 0 && (arg.size() == strlen(option) || arg[strlen(option)] == '=');
+    });
+}
+
+// The options that affect the outputs, so a shader compiled for several targets or with
+// different options gets separate history entries. The frontend key only holds the options
+// that affect the glslang half of the compile.
+std::string compile_options_key(int argc, char* argv[], bool frontend)
+{
+    std::vector<std::string> options;
+    
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        
+        if (arg.compare(0, 2, "--") != 0 || option_in(arg, std::begin(kNonOutputOptions), std::end(kNonOutputOptions)))
+            continue;
+        
+        if (!frontend || option_in(arg, std::begin(kFrontendOptions), std::end(kFrontendOptions)))
+            options.push_back(arg);
+    }
+    
+    std::sort(options.begin(), options.end());
+    
+    std::string key = frontend ? " [glslang]" : "";
+    
+    for (auto& option : options)
+        key += " " + option;
+    
+    return key;
+}
+
+// Averages a measured time with the previous one, so one slow run on a busy machine doesn't
+// dominate.
+void record_compile_time(CompileHistory& history, const std::string& key, double seconds)
+{
+    auto entry = history.find(key);
+    
+    if (entry != history.end())
+        entry->second = 0.5 * (entry->second + seconds);
+    else
+        history[key] = seconds;
+}
+
+// Records the glslang and the cross-compile time of a shader that compiled.
+void record_compile_times(CompileHistory& history, const std::string& input, const std::string& frontend_key, const std::string& options_key,
+                          double frontend_seconds, double seconds)
+{
+    record_compile_time(history, input + frontend_key, frontend_seconds);
+    record_compile_time(history, input + options_key, std::max(seconds - frontend_seconds, 0.0));
+}
+
+// Orders the inputs longest expected compile first, expecting a shader to take its glslang
+// time plus the cross-compile time of the target. Times without history are estimated from
+// the source size, at the seconds per byte seen for the shaders that have them.
+void schedule_by_expected_time(const std::vector<std::string>& inputs, const CompileHistory& history, const std::string& frontend_key, const std::string& options_key,
+                               std::vector<size_t>& order)
+{
+    const std::string* keys[2] = { &frontend_key, &options_key };
+    const double kDefaultSecondsPerByte[2] = { kDefaultFrontendSecondsPerByte, kDefaultCrossCompileSecondsPerByte };
+    
+    std::vector<double> expected[2] = { std::vector<double>(inputs.size(), -1.0), std::vector<double>(inputs.size(), -1.0) };
+    std::vector<double> sizes(inputs.size(), 0.0);
+    double known_seconds[2] = { 0.0, 0.0 };
+    double known_bytes[2] = { 0.0, 0.0 };
+    
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        std::ifstream file(inputs[i], std::ios::binary | std::ios::ate);
+        sizes[i] = file ? double(file.tellg()) : 0.0;
+        
+        for (int part = 0; part < 2; part++)
+        {
+            auto entry = history.find(inputs[i] + *keys[part]);
+            
+            if (entry != history.end())
+            {
+                expected[part][i] = entry->second;
+                known_seconds[part] += entry->second;
+                known_bytes[part] += sizes[i];
+            }
+        }
+    }
+    
+    std::vector<double> total(inputs.size(), 0.0);
+    
+    for (int part = 0; part < 2; part++)
+    {
+        double seconds_per_byte = known_bytes[part] > 0.0 ? known_seconds[part] / known_bytes[part] : kDefaultSecondsPerByte[part];
+        
+        for (size_t i = 0; i < inputs.size(); i++)
+            total[i] += expected[part][i] < 0.0 ? sizes[i] * seconds_per_byte : expected[part][i];
+    }
+    
+    order.resize(inputs.size());
+    
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    
+    std::stable_sort(order.begin(), order.end(), [&total](size_t a, size_t b) {
+        return total[a] > total[b];
+    });
+}
+
+void schedule_inputs(const std::vector<std::string>& inputs, const CompileHistory& history, const std::string& frontend_key, const std::string& options_key,
+                     std::vector<std::string>& scheduled)
+{
+    std::vector<size_t> order;
+    schedule_by_expected_time(inputs, history, frontend_key, options_key, order);
+    
+    for (size_t index : order)
+        scheduled.push_back(inputs[index]);
+}
+
+// Where the worker process compiling input 'index' leaves its glslang time for the parent.
+std::string frontend_time_path(const std::string& history_path, size_t index)
+{
+    return history_path + "." + std::to_string(index) + ".part";
+}
+
+// Prints the jobs of the worker that finished last, which bound the wall-clock time.
+void print_critical_path(const std::vector<worker_pool::JobReport>& reports)
+{
+    if (reports.empty())
+        return;
+    
+    uint32_t last_worker = 0;
+    double end = 0.0;
+    
+    for (auto& report : reports)
+    {
+        if (report.start + report.seconds > end)
+        {
+            end = report.start + report.seconds;
+            last_worker = report.worker;
+        }
+    }
+    
+    std::vector<const worker_pool::JobReport*> path;
+    
+    for (auto& report : reports)
+    {
+        if (report.worker == last_worker)
+            path.push_back(&report);
+    }
+    
+    std::sort(path.begin(), path.end(), [](const worker_pool::JobReport* a, const worker_pool::JobReport* b) {
+        return a->start < b->start;
+    });
+    
+    printf("Critical path (worker %u, %.2f s):\n", last_worker, end);
+    
+    for (const worker_pool::JobReport* report : path)
+        printf("\t%.2f s  %s\n", report->seconds, report->input.c_str());
+}
+
+void print_allocation_stats()
+{
+    allocation_stats::StageAllocations stats[allocation_stats::STAGE_COUNT];
+    allocation_stats::get_stats(stats);
+    
+    printf("Allocations:\n");
+    
+    for (int i = 0; i < allocation_stats::STAGE_COUNT; i++)
+        printf("\t%-14s %10llu allocations, %12llu bytes\n", allocation_stats::stage_name(allocation_stats::Stage(i)), (unsigned long long)stats[i].count, (unsigned long long)stats[i].bytes);
+}
+
+// Where the worker process compiling input 'index' leaves the include cache counters of that
+// compile for the parent, whose own cache stays empty.
+std::string include_stats_path(const std::string& output_path, size_t index)
+{
+    return output_file_path(output_path, "include_cache_stats." + std::to_string(index), ".part");
+}
+
+const char* kJobStatusNames[] =
+{
+    "succeeded",
+    "failed",
+    "crashed",
+    "timed out",
+    "out of memory"
+};
+
+// Compiles every shader listed in 'input_list' in worker processes. The options on the command
+// line are passed through to compile_shader for each of them.
+int compile_shader_list(int argc, char* argv[], const std::string& input_list, const std::string& output_path, const std::string& history_path,
+                        const std::string& cost_report, const worker_pool::PoolOptions& options, bool include_stats)
+{
+    std::vector<std::string> inputs;
+    
+    if (!read_input_list(input_list, inputs))
+        return 1;
+    
+    CompileHistory history;
+    std::string frontend_key = compile_options_key(argc, argv, true);
+    std::string options_key = compile_options_key(argc, argv, false);
+    
+    if (history_path != "")
+        read_compile_history(history_path, history);
+    
+    // longest jobs first, so a large shader doesn't start last and extend the build
+    std::vector<std::string> scheduled;
+    schedule_inputs(inputs, history, frontend_key, options_key, scheduled);
+    
+    std::unordered_map<std::string, size_t> input_index;
+    
+    for (size_t i = 0; i < inputs.size(); i++)
+        input_index[inputs[i]] = i;
+    
+    auto job = [&](const std::string& input)
+    {
+        double frontend_seconds = 0.0;
+        spirv_compiler::IncludeCacheStats before;
+        spirv_compiler::include_cache_stats(before);
+        
+        bool success = compile_input(argc, argv, input, output_path, input_cost_rows_path(cost_report, inputs, input), &frontend_seconds) == 0;
+        
+        // the pool only reports the total time of a job, so pass the glslang part on in a file
+        if (success && history_path != "")
+            write_file_atomic(frontend_time_path(history_path, input_index[input]), std::to_string(frontend_seconds));
+        
+        if (include_stats)
+        {
+            spirv_compiler::IncludeCacheStats after;
+            spirv_compiler::include_cache_stats(after);
+            
+            write_file_atomic(include_stats_path(output_path, input_index[input]),
+                              std::to_string(after.hits - before.hits) + " " + std::to_string(after.misses - before.misses) + " " +
+                              std::to_string(after.bytes_read - before.bytes_read) + " " + std::to_string(after.files - before.files));
+        }
+        
+        return success;
+    };
+    
+    std::vector<worker_pool::JobReport> reports;
+    
+    if (!worker_pool::run(scheduled, job, options, reports))
+        return 1;
+    
+    if (cost_report != "")
+        merge_cost_rows(cost_report, inputs);
+    
+    if (history_path != "")
+    {
+        for (auto& report : reports)
+        {
+            std::string frontend_seconds = take_part_file(frontend_time_path(history_path, input_index[report.input]));
+            
+            if (report.status != worker_pool::JOB_STATUS_SUCCEEDED || frontend_seconds == "")
+                continue;
+            
+            record_compile_times(history, report.input, frontend_key, options_key, std::atof(frontend_seconds.c_str()), report.seconds);
+        }
+        
+        write_compile_history(history_path, history);
+    }
+    
+    uint32_t succeeded = 0;
+    
+    for (auto& report : reports)
+    {
+        if (report.status == worker_pool::JOB_STATUS_SUCCEEDED)
+        {
+            succeeded++;
+            continue;
+        }
+        
+        printf("FAILED: %s (%s", report.input.c_str(), kJobStatusNames[report.status]);
+        
+        if (report.status == worker_pool::JOB_STATUS_CRASHED)
+            printf(", code %d", report.code);
+        
+        printf(", %.2f s)\n", report.seconds);
+    }
+    
+    printf("%u of %u shaders compiled successfully\n", succeeded, uint32_t(reports.size()));
+    print_critical_path(reports);
+    
+    if (include_stats)
+    {
+        spirv_compiler::IncludeCacheStats total = {};
+        
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            unsigned long long hits = 0, misses = 0, bytes_read = 0, files = 0;
+            std::string counters = take_part_file(include_stats_path(output_path, i));
+            
+            if (sscanf(counters.c_str(), "%llu %llu %llu %llu", &hits, &misses, &bytes_read, &files) != 4)
+                continue;
+            
+            total.hits += hits;
+            total.misses += misses;
+            total.bytes_read += bytes_read;
+            total.files += files;
+        }
+        
+        print_include_cache_stats(total);
+    }
+    
+    return succeeded == reports.size() ? 0 : 1;
+}
+
+// Compiles the shaders in the list in this process, with the sources of upcoming shaders read
+// and the outputs of finished ones written while others compile.
+int compile_shader_pipeline(int argc, char* argv[], const std::string& input_list, const std::string& output_path, const std::string& history_path,
+                            const std::string& cost_report, uint32_t worker_count, bool include_stats)
+{
+    std::vector<std::string> inputs;
+    
+    if (!read_input_list(input_list, inputs))
+        return 1;
+    
+    CompileHistory history;
+    std::string frontend_key = compile_options_key(argc, argv, true);
+    std::string options_key = compile_options_key(argc, argv, false);
+    
+    if (history_path != "")
+        read_compile_history(history_path, history);
+    
+    // the compile workers take the inputs in order, so longest expected first here as well
+    std::vector<std::string> scheduled;
+    schedule_inputs(inputs, history, frontend_key, options_key, scheduled);
+    
+    std::unordered_map<std::string, size_t> input_index;
+    
+    for (size_t i = 0; i < inputs.size(); i++)
+        input_index[inputs[i]] = i;
+    
+    // written by the worker compiling the input
+    std::vector<double> frontend_seconds(inputs.size(), 0.0);
+    std::vector<double> compile_seconds(inputs.size(), 0.0);
+    std::vector<double> compile_start_seconds(inputs.size(), 0.0);
+    std::vector<uint32_t> compile_worker(inputs.size(), 0);
+    
+    // numbers the compile threads in the order they take their first input
+    std::mutex worker_mutex;
+    std::unordered_map<std::thread::id, uint32_t> worker_ids;
+    
+    auto start = std::chrono::steady_clock::now();
+    
+    auto prefetch = [](const std::string& input)
+    {
+        // SPIR-V inputs are memory mapped when they're loaded
+        bool spirv_input = input.size() > 4 && input.compare(input.size() - 4, 4, ".spv") == 0;
+        
+        if (!spirv_input)
+            spirv_compiler::prefetch(input);
+    };
+    
+    auto compile = [&](const std::string& input)
+    {
+        size_t index = input_index[input];
+        auto compile_start = std::chrono::steady_clock::now();
+        
+        {
+            std::lock_guard<std::mutex> lock(worker_mutex);
+            auto worker = worker_ids.emplace(std::this_thread::get_id(), uint32_t(worker_ids.size())).first;
+            compile_worker[index] = worker->second;
+        }
+        
+        compile_start_seconds[index] = std::chrono::duration<double>(compile_start - start).count();
+        
+        bool success = compile_input(argc, argv, input, output_path, input_cost_rows_path(cost_report, inputs, input), &frontend_seconds[index]) == 0;
+        
+        compile_seconds[index] = std::chrono::duration<double>(std::chrono::steady_clock::now() - compile_start).count();
+        
+        return success;
+    };
+    
+    pipeline::PipelineOptions options;
+    options.compile_count = worker_count;
+    
+    std::vector<bool> results;
+    
+    spirv_compiler::initialize();
+    pipeline::run(scheduled, prefetch, compile, options, results);
+    spirv_compiler::finalize();
+    
+    if (cost_report != "")
+        merge_cost_rows(cost_report, inputs);
+    
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint32_t succeeded = 0;
+    std::vector<worker_pool::JobReport> reports;
+    
+    for (size_t i = 0; i < scheduled.size(); i++)
+    {
+        size_t index = input_index[scheduled[i]];
+        
+        worker_pool::JobReport report;
+        report.input = scheduled[i];
+        report.status = results[i] ? worker_pool::JOB_STATUS_SUCCEEDED : worker_pool::JOB_STATUS_FAILED;
+        report.code = 0;
+        report.seconds = compile_seconds[index];
+        report.start = compile_start_seconds[index];
+        report.worker = compile_worker[index];
+        reports.push_back(report);
+        
+        if (results[i])
+        {
+            record_compile_times(history, scheduled[i], frontend_key, options_key, frontend_seconds[index], compile_seconds[index]);
+            succeeded++;
+        }
+        else
+            printf("FAILED: %s\n", scheduled[i].c_str());
+    }
+    
+    if (history_path != "")
+        write_compile_history(history_path, history);
+    
+    printf("%u of %u shaders compiled successfully in %.2f s\n", succeeded, uint32_t(inputs.size()), seconds);
+    print_critical_path(reports);
+    
+    if (include_stats)
+    {
+        spirv_compiler::IncludeCacheStats stats;
+        spirv_compiler::include_cache_stats(stats);
+        print_include_cache_stats(stats);
+    }
+    
+    return succeeded == inputs.size() ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    ArgumentParser parser;
+    
+    parser.add_option("input-list");
+    parser.add_option("workers");
+    parser.add_option("job-timeout");
+    parser.add_option("job-memory-limit");
+    parser.add_option("compile-history");
+    parser.add_option("cost-report");
+    parser.add_option("scan-deps");
+    parser.add_option("shader-stage");
+    parser.add_bool_option("vulkan-glsl");
+    parser.add_bool_option("native-16bit-types");
+    parser.add_bool_option("watch");
+    parser.add_option("watch-debounce");
+    parser.add_bool_option("pipeline");
+    parser.add_bool_option("allocation-stats");
+    parser.add_bool_option("include-cache-stats");
+    parser.parse(argc, argv);
+    
+    std::string input_list = parser.argument("input-list");
+    std::string scan_deps = parser.argument("scan-deps");
+    bool watch = parser.bool_argument("watch");
+    bool include_stats = parser.bool_argument("include-cache-stats");
+    
+    if (input_list == "" && scan_deps == "" && !watch)
+    {
+        bool count_allocations = parser.bool_argument("allocation-stats");
+        allocation_stats::set_enabled(count_allocations);
+        
+        int result = compile_shader(argc, argv);
+        
+        if (count_allocations)
+            print_allocation_stats();
+        
+        if (include_stats)
+        {
+            spirv_compiler::IncludeCacheStats stats;
+            spirv_compiler::include_cache_stats(stats);
+            print_include_cache_stats(stats);
+        }
+        
+        return result;
+    }
+    
+    worker_pool::PoolOptions options;
+    uint32_t debounce_ms = 30;
+    
+    try
+    {
+        if (parser.argument("workers") != "")
+            options.worker_count = uint32_t(std::stoul(parser.argument("workers")));
+        
+        if (parser.argument("job-timeout") != "")
+            options.timeout_ms = uint32_t(std::stod(parser.argument("job-timeout")) * 1000.0);
+        
+        if (parser.argument("job-memory-limit") != "")
+            options.memory_limit = uint64_t(std::stoull(parser.argument("job-memory-limit"))) << 20;
+        
+        if (parser.argument("watch-debounce") != "")
+            debounce_ms = uint32_t(std::stoul(parser.argument("watch-debounce")));
+    }
+    catch (const std::exception&)
+    {
+        printf("ERROR: Invalid worker pool option specified!\n");
+        return 1;
+    }
+    
+    if (scan_deps != "")
+        return scan_dependencies(parser, scan_deps, options.worker_count);
+    
+    if (watch)
+        return watch_shaders(argc, argv, parser, debounce_ms);
+    
+    if (parser.bool_argument("pipeline"))
+        return compile_shader_pipeline(argc, argv, input_list, parser.ordered_argument(0), parser.argument("compile-history"), parser.argument("cost-report"), options.worker_count, include_stats);
+    
+    return compile_shader_list(argc, argv, input_list, parser.ordered_argument(0), parser.argument("compile-history"), parser.argument("cost-report"), options, include_stats);
 }
@@ -0,0 +1,193 @@
+#include "pipeline.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <fstream>
+
+#ifdef WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace pipeline
+{
+    struct Output
+    {
+        size_t input;
+        std::string path;
+        std::string contents;
+    };
+    
+    struct PendingRename
+    {
+        size_t input;
+        std::string temp_path;
+        std::string path;
+    };
+    
+    // set on the compile worker threads while the pipeline runs
+    thread_local BoundedQueue<Output>* t_Outputs = nullptr;
+    thread_local size_t t_Input = 0;
+    
+    bool writing_outputs()
+    {
+        return t_Outputs != nullptr;
+    }
+    
+    void write_output(const std::string& path, std::string contents)
+    {
+        Output output;
+        output.input = t_Input;
+        output.path = path;
+        output.contents = std::move(contents);
+        
+        t_Outputs->push(std::move(output));
+    }
+    
+    bool rename_file(const std::string& from, const std::string& to)
+    {
+#ifdef WIN32
+        return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+    }
+    
+    void flush_renames(std::vector<PendingRename>& pending, std::vector<char>& write_failed)
+    {
+        for (const PendingRename& rename : pending)
+        {
+            if (!rename_file(rename.temp_path, rename.path))
+            {
+                printf("ERROR: Failed to write %s\n", rename.path.c_str());
+                std::remove(rename.temp_path.c_str());
+                write_failed[rename.input] = 1;
+            }
+        }
+        
+        pending.clear();
+    }
+    
+    // Writes every output to a temporary file next to its target, and renames a batch of them
+    // over the targets once it's full or the compile workers have nothing more to write yet.
+    void writer_main(BoundedQueue<Output>& outputs, uint32_t batch_size, std::vector<char>& write_failed)
+    {
+        std::vector<PendingRename> pending;
+        Output output;
+        
+        while (true)
+        {
+            if (!outputs.try_pop(output))
+            {
+                flush_renames(pending, write_failed);
+                
+                if (!outputs.pop(output))
+                    break;
+            }
+            
+            // a second output for the same path would overwrite the temporary file of the first
+            bool duplicate = std::any_of(pending.begin(), pending.end(), [&output](const PendingRename& rename) {
+                return rename.path == output.path;
+            });
+            
+            if (duplicate)
+                flush_renames(pending, write_failed);
+            
+            std::string temp_path = output.path + ".tmp";
+            std::ofstream out(temp_path);
+            out << output.contents;
+            out.close();
+            
+            if (!out)
+            {
+                printf("ERROR: Failed to write %s\n", temp_path.c_str());
+                std::remove(temp_path.c_str());
+                write_failed[output.input] = 1;
+                continue;
+            }
+            
+            pending.push_back({ output.input, temp_path, output.path });
+            
+            if (pending.size() >= batch_size)
+                flush_renames(pending, write_failed);
+        }
+        
+        flush_renames(pending, write_failed);
+    }
+    
+    bool run(const std::vector<std::string>& inputs, const PrefetchFunction& prefetch, const CompileFunction& compile, const PipelineOptions& options, std::vector<bool>& results)
+    {
+        size_t input_count = std::max<size_t>(inputs.size(), 1);
+        uint32_t reader_count = uint32_t(std::min<size_t>(std::max(options.reader_count, 1u), input_count));
+        uint32_t compile_count = options.compile_count;
+        
+        if (compile_count == 0)
+            compile_count = std::max(1u, std::thread::hardware_concurrency());
+        
+        compile_count = uint32_t(std::min<size_t>(compile_count, input_count));
+        
+        BoundedQueue<size_t> prefetched(options.queue_capacity);
+        BoundedQueue<Output> outputs(options.queue_capacity);
+        std::vector<char> compiled(inputs.size(), 0);
+        std::vector<char> write_failed(inputs.size(), 0);
+        std::atomic<size_t> next_input(0);
+        std::atomic<uint32_t> readers_left(reader_count);
+        std::atomic<uint32_t> compilers_left(compile_count);
+        
+        auto reader = [&]()
+        {
+            for (size_t i = next_input++; i < inputs.size(); i = next_input++)
+            {
+                if (prefetch)
+                    prefetch(inputs[i]);
+                
+                prefetched.push(i);
+            }
+            
+            if (--readers_left == 0)
+                prefetched.close();
+        };
+        
+        auto compiler = [&]()
+        {
+            t_Outputs = &outputs;
+            size_t index;
+            
+            while (prefetched.pop(index))
+            {
+                t_Input = index;
+                compiled[index] = compile(inputs[index]) ? 1 : 0;
+            }
+            
+            t_Outputs = nullptr;
+            
+            if (--compilers_left == 0)
+                outputs.close();
+        };
+        
+        std::thread writer(writer_main, std::ref(outputs), std::max(options.write_batch, 1u), std::ref(write_failed));
+        std::vector<std::thread> threads;
+        
+        for (uint32_t i = 0; i < reader_count; i++)
+            threads.push_back(std::thread(reader));
+        
+        for (uint32_t i = 0; i < compile_count; i++)
+            threads.push_back(std::thread(compiler));
+        
+        for (std::thread& thread : threads)
+            thread.join();
+        
+        writer.join();
+        
+        results.resize(inputs.size());
+        bool success = true;
+        
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            results[i] = compiled[i] && !write_failed[i];
+            success = success && results[i];
+        }
+        
+        return success;
+    }
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+namespace pipeline
+{
+    // Bounded multi-producer multi-consumer queue without locks (Vyukov's array-based queue).
+    // The blocking push() waits while the queue is full, which keeps a stage from running
+    // further ahead of the next one than the queue's capacity.
+    template <typename T>
+    class BoundedQueue
+    {
+    public:
+        explicit BoundedQueue(size_t capacity)
+        {
+            size_t size = 2;
+            
+            while (size < capacity)
+                size *= 2;
+            
+            cells.reset(new Cell[size]);
+            mask = size - 1;
+            
+            for (size_t i = 0; i < size; i++)
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        
+        bool try_push(T& value)
+        {
+            size_t position = tail.load(std::memory_order_relaxed);
+            
+            while (true)
+            {
+                Cell& cell = cells[position & mask];
+                intptr_t difference = intptr_t(cell.sequence.load(std::memory_order_acquire)) - intptr_t(position);
+                
+                if (difference == 0)
+                {
+                    if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        cell.value = std::move(value);
+                        cell.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                    return false;
+                else
+                    position = tail.load(std::memory_order_relaxed);
+            }
+        }
+        
+        bool try_pop(T& value)
+        {
+            size_t position = head.load(std::memory_order_relaxed);
+            
+            while (true)
+            {
+                Cell& cell = cells[position & mask];
+                intptr_t difference = intptr_t(cell.sequence.load(std::memory_order_acquire)) - intptr_t(position + 1);
+                
+                if (difference == 0)
+                {
+                    if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        value = std::move(cell.value);
+                        cell.sequence.store(position + mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                    return false;
+                else
+                    position = head.load(std::memory_order_relaxed);
+            }
+        }
+        
+        void push(T value)
+        {
+            for (uint32_t attempt = 0; !try_push(value); attempt++)
+                back_off(attempt);
+        }
+        
+        // Returns false once the queue is closed and empty.
+        bool pop(T& value)
+        {
+            for (uint32_t attempt = 0; !try_pop(value); attempt++)
+            {
+                if (closed.load(std::memory_order_acquire))
+                    return try_pop(value);
+                
+                back_off(attempt);
+            }
+            
+            return true;
+        }
+        
+        // Called by the producers once they are done, so consumers stop after draining it.
+        void close()
+        {
+            closed.store(true, std::memory_order_release);
+        }
+    
+    private:
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+        
+        // stages wait on each other for milliseconds, so after a short spin sleep rather than
+        // keep a core busy
+        static void back_off(uint32_t attempt)
+        {
+            if (attempt < 64)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        
+        std::unique_ptr<Cell[]> cells;
+        size_t mask;
+        alignas(64) std::atomic<size_t> head { 0 };
+        alignas(64) std::atomic<size_t> tail { 0 };
+        std::atomic<bool> closed { false };
+    };
+    
+    struct PipelineOptions
+    {
+        uint32_t reader_count = 2;
+        uint32_t compile_count = 0;   // 0 uses one compile worker per hardware thread
+        uint32_t queue_capacity = 16;
+        uint32_t write_batch = 32;    // outputs written to temp files before they are renamed
+    };
+    
+    // Reads an input ahead of its compile, e.g. into the include cache.
+    typedef std::function<void(const std::string& input)> PrefetchFunction;
+    
+    // Compiles an input, handing its outputs to write_output(), and returns whether it succeeded.
+    typedef std::function<bool(const std::string& input)> CompileFunction;
+    
+    // Runs every input through three stages connected by bounded queues: reader threads that
+    // prefetch the inputs, compile workers, and one writer thread that writes the outputs to
+    // temporary files and renames them over the targets in batches. 'results' is in the same
+    // order as 'inputs'; an input fails if its compile or any of its writes failed.
+    extern bool run(const std::vector<std::string>& inputs, const PrefetchFunction& prefetch, const CompileFunction& compile, const PipelineOptions& options, std::vector<bool>& results);
+    
+    // Whether the calling thread is a compile worker, whose outputs go to write_output().
+    // Other callers write their files themselves.
+    extern bool writing_outputs();
+    
+    // Queues 'contents' for the writer thread. Only valid on a compile worker, and blocks
+    // while the writer is behind.
+    extern void write_output(const std::string& path, std::string contents);
+}
@@ -1,4 +1,5 @@
 #include "spirv_compiler.h"
+#include "allocation_stats.h"
 #ifndef _CRT_SECURE_NO_WARNINGS
 #define _CRT_SECURE_NO_WARNINGS
 #endif
@@ -19,9 +20,17 @@
 #include <cctype>
 #include <cmath>
 #include <array>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <sys/stat.h>
 #include <thread>
+#include <atomic>
 
 #include <../OSDependent/osinclude.h>
 
@@ -99,37 +108,39 @@ namespace spirv_compiler
     void FreeFileData(char* data);
     void InfoLogMsg(const char* msg, const char* name, const int num);
     
-    // Globally track if any compile or link failure.
-    bool CompileFailed = false;
-    bool LinkFailed = false;
+    // Track if any compile or link failure. The settings SetupTarget() writes are per thread
+    // too, so compiles on different threads don't wait for each other.
+    thread_local bool CompileFailed = false;
+    thread_local bool LinkFailed = false;
     
     // array of unique places to leave the shader names and infologs for the asynchronous compiles
     std::vector<std::unique_ptr<glslang::TWorkItem>> WorkItems;
     
-    TBuiltInResource Resources;
+    thread_local TBuiltInResource Resources;
     
     int ReflectOptions = EShReflectionDefault;
-    int Options = 0;
+    thread_local int Options = 0;
     const char* ExecutableName = nullptr;
     const char* binaryFileName = nullptr;
     const char* entryPointName = nullptr;
     const char* sourceEntryPointName = nullptr;
     const char* shaderStageName = nullptr;
     const char* variableName = nullptr;
-    bool HlslEnable16BitTypes = false;
+    thread_local bool HlslEnable16BitTypes = false;
+    thread_local bool Enable16BitTypes = false;
     bool HlslDX9compatible = false;
     bool DumpBuiltinSymbols = false;
     std::vector<std::string> IncludeDirectoryList;
     
     // Source environment
     // (source 'Client' is currently the same as target 'Client')
-    int ClientInputSemanticsVersion = 100;
+    thread_local int ClientInputSemanticsVersion = 100;
     
     // Target environment
-    glslang::EShClient Client = glslang::EShClientNone;  // will stay EShClientNone if only validating
-    glslang::EShTargetClientVersion ClientVersion;       // not valid until Client is set
-    glslang::EShTargetLanguage TargetLanguage = glslang::EShTargetNone;
-    glslang::EShTargetLanguageVersion TargetVersion;     // not valid until TargetLanguage is set
+    thread_local glslang::EShClient Client = glslang::EShClientNone;  // will stay EShClientNone if only validating
+    thread_local glslang::EShTargetClientVersion ClientVersion;       // not valid until Client is set
+    thread_local glslang::EShTargetLanguage TargetLanguage = glslang::EShTargetNone;
+    thread_local glslang::EShTargetLanguageVersion TargetVersion;     // not valid until TargetLanguage is set
     
     std::vector<std::string> Processes;                     // what should be recorded by OpModuleProcessed, or equivalent
     
@@ -150,6 +161,7 @@ namespace spirv_compiler
         
         bool isSet() const { return text.size() > 0; }
         const char* get() const { return text.c_str(); }
+        const std::vector<std::string>& getProcesses() const { return processes; }
         
         // #define...
         void addDef(std::string def)
@@ -157,8 +169,8 @@ namespace spirv_compiler
             text.append("#define ");
             fixLine(def);
             
-            Processes.push_back("D");
-            Processes.back().append(def);
+            processes.push_back("D");
+            processes.back().append(def);
             
             // The first "=" needs to turn into a space
             const size_t equal = def.find_first_of("=");
@@ -175,8 +187,8 @@ namespace spirv_compiler
             text.append("#undef ");
             fixLine(undef);
             
-            Processes.push_back("U");
-            Processes.back().append(undef);
+            processes.push_back("U");
+            processes.back().append(undef);
             
             text.append(undef);
             text.append("\n");
@@ -192,10 +204,25 @@ namespace spirv_compiler
         }
         
         std::string text;  // contents of preamble
+        std::vector<std::string> processes;  // recorded with OpModuleProcessed
     };
     
     TPreamble UserPreamble;
     
+    // Defined for the stage being compiled when several stages are built from one source.
+    const char* kShaderStageMacros[] =
+    {
+        "VERTEX",
+        "FRAGMENT",
+        "COMPUTE"
+    };
+    
+    // GLSL extensions enabled in the preamble when native 16-bit types are requested.
+    const char* k16BitTypeExtensions =
+        "#extension GL_EXT_shader_explicit_arithmetic_types_float16 : enable\n"
+        "#extension GL_EXT_shader_explicit_arithmetic_types_int16 : enable\n"
+        "#extension GL_EXT_shader_16bit_storage : enable\n";
+    
     //
     // Give error and exit with failure code.
     //
@@ -231,6 +258,7 @@ namespace spirv_compiler
         const char* text[maxCount];         // memory owned/managed externally
         std::string fileName[maxCount];     // hold's the memory, but...
         const char* fileNameList[maxCount]; // downstream interface wants pointers
+        TPreamble preamble;                 // appended to the user preamble for this unit only
         
         ShaderCompUnit(EShLanguage stage) : stage(stage), count(0) { }
         
@@ -238,6 +266,7 @@ namespace spirv_compiler
         {
             stage = rhs.stage;
             count = rhs.count;
+            preamble = rhs.preamble;
             for (int i = 0; i < count; ++i) {
                 fileName[i] = rhs.fileName[i];
                 text[i] = rhs.text[i];
@@ -255,38 +284,253 @@ namespace spirv_compiler
         }
     };
 
+    // FNV-1a
+    uint64_t HashText(const std::string& text)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        
+        for (char c : text)
+            hash = (hash ^ uint8_t(c)) * 1099511628211ull;
+        
+        return hash;
+    }
+    
+    // Contents of the include files read so far, shared by every compile in the process so
+    // common headers are read from disk once. Entries are keyed by the normalized path and
+    // revalidated against the file's modification time and size on every lookup; a changed
+    // file whose contents hash the same keeps its buffer.
+    class TIncludeCache {
+    public:
+        // Returns nullptr if the file can't be opened. The buffer stays valid while it's
+        // referenced, even if the entry is replaced.
+        std::shared_ptr<const std::string> read(const std::string& path)
+        {
+            std::string key = NormalizePath(path);
+            struct stat info;
+            
+            if (stat(key.c_str(), &info) != 0 || (info.st_mode & S_IFMT) != S_IFREG)
+                return nullptr;
+            
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = files.find(key);
+                
+                if (it != files.end() && it->second.mtime == ModificationTime(info) && it->second.size == int64_t(info.st_size)) {
+                    hits++;
+                    return it->second.contents;
+                }
+            }
+            
+            // read without holding the lock, another thread may add the same file meanwhile
+            std::ifstream file(key, std::ios_base::binary);
+            
+            if (!file)
+                return nullptr;
+            
+            std::shared_ptr<const std::string> contents = std::make_shared<const std::string>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            uint64_t hash = HashText(*contents);
+            
+            std::lock_guard<std::mutex> lock(mutex);
+            TEntry& entry = files[key];
+            
+            if (entry.contents && entry.hash == hash && *entry.contents == *contents) {
+                hits++;
+                contents = entry.contents;
+            } else {
+                misses++;
+                bytesRead += contents->size();
+                entry.contents = contents;
+                entry.hash = hash;
+            }
+            
+            entry.mtime = ModificationTime(info);
+            entry.size = int64_t(info.st_size);
+            
+            return contents;
+        }
+        
+        void getStats(IncludeCacheStats& stats)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.hits = hits;
+            stats.misses = misses;
+            stats.bytes_read = bytesRead;
+            stats.files = files.size();
+        }
+        
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            files.clear();
+            hits = 0;
+            misses = 0;
+            bytesRead = 0;
+        }
+        
+        // Collapses "." and ".." components and duplicate separators, so the same file
+        // reached through different include directories shares one entry.
+        static std::string NormalizePath(std::string path)
+        {
+            std::replace(path.begin(), path.end(), '\\', '/');
+            
+            std::vector<std::string> parts;
+            bool absolute = !path.empty() && path[0] == '/';
+            size_t start = 0;
+            
+            while (start <= path.size()) {
+                size_t end = path.find('/', start);
+                std::string part = path.substr(start, end == std::string::npos ? std::string::npos : end - start);
+                
+                if (part == "..") {
+                    if (!parts.empty() && parts.back() != "..")
+                        parts.pop_back();
+                    else if (!absolute)
+                        parts.push_back(part);
+                } else if (!part.empty() && part != ".")
+                    parts.push_back(part);
+                
+                if (end == std::string::npos)
+                    break;
+                
+                start = end + 1;
+            }
+            
+            std::string normalized = absolute ? "/" : "";
+            
+            for (size_t i = 0; i < parts.size(); i++)
+                normalized += (i > 0 ? "/" : "") + parts[i];
+            
+            return normalized.empty() ? "." : normalized;
+        }
+        
+    protected:
+        // Nanoseconds where the platform has them, so quick successive saves are told apart.
+        static int64_t ModificationTime(const struct stat& info)
+        {
+#if defined(__linux__)
+            return int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+            return int64_t(info.st_mtimespec.tv_sec) * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+            return int64_t(info.st_mtime) * 1000000000;
+#endif
+        }
+        
+        struct TEntry {
+            std::shared_ptr<const std::string> contents;
+            uint64_t hash = 0;
+            int64_t mtime = 0;
+            int64_t size = 0;
+        };
+        
+        std::mutex mutex;
+        std::unordered_map<std::string, TEntry> files;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t bytesRead = 0;
+    };
+    
+    TIncludeCache IncludeCache;
+    
+    // Parsing and linking run on any number of threads at once, but glslang's SPIR-V
+    // generation isn't documented as thread safe, so it runs one module at a time.
+    std::mutex SpirvGenerationMutex;
+    
+    // DirStackFileIncluder that resolves the include directories the same way, but takes the
+    // file contents from a TIncludeCache.
+    class TCachingFileIncluder : public DirStackFileIncluder {
+    public:
+        TCachingFileIncluder(TIncludeCache& cache) : cache(cache) { }
+        
+        virtual void releaseInclude(IncludeResult* result) override
+        {
+            // the contents are owned by the cache, the result only holds a reference
+            if (result != nullptr) {
+                delete static_cast<std::shared_ptr<const std::string>*>(result->userData);
+                delete result;
+            }
+        }
+        
+    protected:
+        virtual IncludeResult* readLocalPath(const char* headerName, const char* includerName, int depth) override
+        {
+            // Discard popped include directories, and
+            // initialize when at parse-time first level.
+            directoryStack.resize(depth + externalLocalDirectoryCount);
+            if (depth == 1)
+                directoryStack.back() = getDirectory(includerName);
+            
+            // Find a directory that works, using a reverse search of the include stack.
+            for (auto it = directoryStack.rbegin(); it != directoryStack.rend(); ++it) {
+                std::string path = *it + '/' + headerName;
+                std::replace(path.begin(), path.end(), '\\', '/');
+                
+                std::shared_ptr<const std::string> contents = cache.read(path);
+                
+                if (contents) {
+                    directoryStack.push_back(getDirectory(path));
+                    return new IncludeResult(path, contents->data(), contents->size(), new std::shared_ptr<const std::string>(contents));
+                }
+            }
+            
+            return nullptr;
+        }
+        
+        TIncludeCache& cache;
+    };
+    
+    // TCachingFileIncluder that records the normalized path of every file it resolves.
+    class TRecordingFileIncluder : public TCachingFileIncluder {
+    public:
+        TRecordingFileIncluder(TIncludeCache& cache, std::vector<std::string>& includes) : TCachingFileIncluder(cache), includes(includes) { }
+        
+        virtual IncludeResult* includeLocal(const char* headerName, const char* includerName, size_t inclusionDepth) override
+        {
+            IncludeResult* result = TCachingFileIncluder::includeLocal(headerName, includerName, inclusionDepth);
+            
+            if (result != nullptr)
+                includes.push_back(TIncludeCache::NormalizePath(result->headerName));
+            
+            return result;
+        }
+        
+    protected:
+        std::vector<std::string>& includes;
+    };
+    
     //
-    // For linking mode: Will independently parse each compilation unit, but then put them
-    // in the same program and link them together, making at most one linked module per
-    // pipeline stage.
-    //
-    // Uses the new C++ interface instead of the old handle-based interface.
+    // Preamble text of a compilation unit, which must outlive the shader it is set on.
     //
-    
-    void CompileAndLinkShaderUnits(const ShaderCompUnit& compUnit, std::vector<unsigned int>& spirv)
+    std::string ShaderPreamble(const ShaderCompUnit& compUnit)
     {
-        EShMessages messages = EShMsgDefault;
+        std::string preamble = UserPreamble.get();
+        preamble += compUnit.preamble.get();
         
-        //
-        // Per-shader processing...
-        //
-        
-        glslang::TProgram& program = *new glslang::TProgram;
+        if (Enable16BitTypes && !(Options & EOptionReadHlsl))
+            preamble += k16BitTypeExtensions;
         
-        glslang::TShader* shader = new glslang::TShader(compUnit.stage);
-        shader->setStringsWithLengthsAndNames(compUnit.text, NULL, compUnit.fileNameList, compUnit.count);
+        return preamble;
+    }
+    
+    //
+    // Applies the entry point, preamble, binding and environment options to a shader.
+    //
+    void ConfigureShader(glslang::TShader& shader, const ShaderCompUnit& compUnit, const std::string& preamble)
+    {
         if (entryPointName)
-            shader->setEntryPoint(entryPointName);
+            shader.setEntryPoint(entryPointName);
         if (sourceEntryPointName)
         {
             if (entryPointName == nullptr)
                 printf("Warning: Changing source entry point name without setting an entry-point name.\n"
                        "Use '-e <name>'.\n");
-            shader->setSourceEntryPoint(sourceEntryPointName);
+            shader.setSourceEntryPoint(sourceEntryPointName);
         }
-        if (UserPreamble.isSet())
-            shader->setPreamble(UserPreamble.get());
-        shader->addProcesses(Processes);
+        if (!preamble.empty())
+            shader.setPreamble(preamble.c_str());
+        shader.addProcesses(Processes);
+        shader.addProcesses(UserPreamble.getProcesses());
+        shader.addProcesses(compUnit.preamble.getProcesses());
         
         // Set IO mapper binding shift values
         for (int r = 0; r < glslang::EResCount; ++r)
@@ -294,76 +538,118 @@ namespace spirv_compiler
             const glslang::TResourceType res = glslang::TResourceType(r);
             
             // Set base bindings
-            shader->setShiftBinding(res, baseBinding[res][compUnit.stage]);
+            shader.setShiftBinding(res, baseBinding[res][compUnit.stage]);
             
             // Set bindings for particular resource sets
             // TODO: use a range based for loop here, when available in all environments.
             for (auto i = baseBindingForSet[res][compUnit.stage].begin();
                  i != baseBindingForSet[res][compUnit.stage].end(); ++i)
-                shader->setShiftBindingForSet(res, i->second, i->first);
+                shader.setShiftBindingForSet(res, i->second, i->first);
         }
 
-        shader->setNoStorageFormat((Options & EOptionNoStorageFormat) != 0);
-        shader->setResourceSetBinding(baseResourceSetBinding[compUnit.stage]);
+        shader.setNoStorageFormat((Options & EOptionNoStorageFormat) != 0);
+        shader.setResourceSetBinding(baseResourceSetBinding[compUnit.stage]);
 
         if (Options & EOptionAutoMapBindings)
-            shader->setAutoMapBindings(true);
+            shader.setAutoMapBindings(true);
         
         if (Options & EOptionAutoMapLocations)
-            shader->setAutoMapLocations(true);
+            shader.setAutoMapLocations(true);
         
         if (Options & EOptionInvertY)
-            shader->setInvertY(true);
+            shader.setInvertY(true);
         
         for (auto& uniOverride : uniformLocationOverrides) {
-            shader->addUniformLocationOverride(uniOverride.first.c_str(),
-                                               uniOverride.second);
+            shader.addUniformLocationOverride(uniOverride.first.c_str(),
+                                              uniOverride.second);
         }
         
-        shader->setUniformLocationBase(uniformBase);
+        shader.setUniformLocationBase(uniformBase);
         
         // Set up the environment, some subsettings take precedence over earlier
         // ways of setting things.
         if (Options & EOptionSpv)
         {
-            shader->setEnvInput((Options & EOptionReadHlsl) ? glslang::EShSourceHlsl
-                                : glslang::EShSourceGlsl,
-                                compUnit.stage, Client, ClientInputSemanticsVersion);
-            shader->setEnvClient(Client, ClientVersion);
-            shader->setEnvTarget(TargetLanguage, TargetVersion);
+            shader.setEnvInput((Options & EOptionReadHlsl) ? glslang::EShSourceHlsl
+                               : glslang::EShSourceGlsl,
+                               compUnit.stage, Client, ClientInputSemanticsVersion);
+            shader.setEnvClient(Client, ClientVersion);
+            shader.setEnvTarget(TargetLanguage, TargetVersion);
         }
+    }
+    
+    EShMessages ShaderMessages()
+    {
+        EShMessages messages = EShMsgDefault;
         
-        const int defaultVersion = Options & EOptionDefaultDesktop ? 110 : 100;
+        if (HlslEnable16BitTypes)
+            messages = (EShMessages)(messages | EShMsgHlslEnable16BitTypes);
         
-        DirStackFileIncluder includer;
+        return messages;
+    }
+    
+    //
+    // For linking mode: Will independently parse each compilation unit, but then put them
+    // in the same program and link them together, making at most one linked module per
+    // pipeline stage.
+    //
+    // Uses the new C++ interface instead of the old handle-based interface.
+    //
+    
+    void CompileAndLinkShaderUnits(const std::vector<ShaderCompUnit>& compUnits, TIncludeCache& includeCache, std::vector<std::vector<unsigned int>>& spirv)
+    {
+        EShMessages messages = ShaderMessages();
         
-        std::for_each(IncludeDirectoryList.rbegin(), IncludeDirectoryList.rend(), [&includer](const std::string& dir)
-                      {
-                          includer.pushExternalLocalDirectory(dir);
-                      });
+        //
+        // Per-shader processing...
+        //
+        
+        // glslang can't reparse a TShader or relink a TProgram, so those are created for every
+        // compile, but the list holding the shaders is kept per thread and reused
+        thread_local std::vector<glslang::TShader*> shaders;
+        glslang::TProgram& program = *new glslang::TProgram;
         
-        if (Options & EOptionOutputPreprocessed)
+        for (const ShaderCompUnit& compUnit : compUnits)
         {
-            std::string str;
-            if (shader->preprocess(&Resources, defaultVersion, ENoProfile, false, false, messages, &str, includer))
-                PutsIfNonEmpty(str.c_str());
-            else
+            glslang::TShader* shader = new glslang::TShader(compUnit.stage);
+            shader->setStringsWithLengthsAndNames(compUnit.text, NULL, compUnit.fileNameList, compUnit.count);
+            std::string preamble = ShaderPreamble(compUnit);
+            ConfigureShader(*shader, compUnit, preamble);
+            
+            shaders.push_back(shader);
+            
+            const int defaultVersion = Options & EOptionDefaultDesktop ? 110 : 100;
+            
+            TCachingFileIncluder includer(includeCache);
+            
+            std::for_each(IncludeDirectoryList.rbegin(), IncludeDirectoryList.rend(), [&includer](const std::string& dir)
+                          {
+                              includer.pushExternalLocalDirectory(dir);
+                          });
+            
+            if (Options & EOptionOutputPreprocessed)
+            {
+                std::string str;
+                if (shader->preprocess(&Resources, defaultVersion, ENoProfile, false, false, messages, &str, includer))
+                    PutsIfNonEmpty(str.c_str());
+                else
+                    CompileFailed = true;
+                
+                StderrIfNonEmpty(shader->getInfoLog());
+                StderrIfNonEmpty(shader->getInfoDebugLog());
+            }
+            
+            if (! shader->parse(&Resources, defaultVersion, false, messages, includer))
                 CompileFailed = true;
             
-            StderrIfNonEmpty(shader->getInfoLog());
-            StderrIfNonEmpty(shader->getInfoDebugLog());
-        }
-        
-        if (! shader->parse(&Resources, defaultVersion, false, messages, includer))
-            CompileFailed = true;
-        
-        program.addShader(shader);
-        
-        if (! (Options & EOptionSuppressInfolog) &&
-            ! (Options & EOptionMemoryLeakMode)) {
-            PutsIfNonEmpty(compUnit.fileName[0].c_str());
-            PutsIfNonEmpty(shader->getInfoLog());
-            PutsIfNonEmpty(shader->getInfoDebugLog());
+            program.addShader(shader);
+            
+            if (! (Options & EOptionSuppressInfolog) &&
+                ! (Options & EOptionMemoryLeakMode)) {
+                PutsIfNonEmpty(compUnit.fileName[0].c_str());
+                PutsIfNonEmpty(shader->getInfoLog());
+                PutsIfNonEmpty(shader->getInfoDebugLog());
+            }
         }
         
         //
@@ -386,13 +672,22 @@ namespace spirv_compiler
             program.dumpReflection();
         }
         
-        // Dump SPIR-V
+        // Dump SPIR-V, one module per compilation unit in the order they were given. The
+        // modules are cleared rather than reallocated, so callers that pass the same vectors
+        // to every compile keep their capacity.
+        spirv.resize(compUnits.size());
+        
+        for (std::vector<unsigned int>& module : spirv)
+            module.clear();
+        
         if (CompileFailed || LinkFailed)
             printf("SPIR-V is not generated for failed compile or link\n");
         else {
-            for (int stage = 0; stage < EShLangCount; ++stage)
+            for (size_t unit = 0; unit < compUnits.size(); ++unit)
             {
-                if (program.getIntermediate((EShLanguage)stage))
+                EShLanguage stage = compUnits[unit].stage;
+                
+                if (program.getIntermediate(stage))
                 {
                     std::string warningsErrors;
                     spv::SpvBuildLogger logger;
@@ -406,7 +701,8 @@ namespace spirv_compiler
                     spvOptions.disassemble = SpvToolsDisassembler;
                     spvOptions.validate = SpvToolsValidate;
                     
-                    glslang::GlslangToSpv(*program.getIntermediate((EShLanguage)stage), spirv, &logger, &spvOptions);
+                    std::lock_guard<std::mutex> lock(SpirvGenerationMutex);
+                    glslang::GlslangToSpv(*program.getIntermediate(stage), spirv[unit], &logger, &spvOptions);
                 }
             }
         }
@@ -416,7 +712,9 @@ namespace spirv_compiler
         // the stuff from the shaders has to have its destructors called
         // before the pools holding the memory in the shaders is freed.
         delete &program;
-        delete shader;
+        for (glslang::TShader* shader : shaders)
+            delete shader;
+        shaders.clear();
     }
     
     //
@@ -432,24 +730,220 @@ namespace spirv_compiler
     // performance and memory testing, the actual compile/link can be put in
     // a loop, independent of processing the work items and file IO.
     //
-    bool CompileAndLinkShaderFiles(std::string path, ShaderStage stage, std::vector<unsigned int>& spirv)
+    bool CompileAndLinkShaderFiles(const std::vector<ShaderSource>& sources, std::vector<std::vector<unsigned int>>& spirv)
     {
-        ShaderCompUnit compUnit(kShaderStageMap[stage]);
-        char* fileText = ReadFileData(path.c_str());
+        std::vector<ShaderCompUnit> compUnits;
+        std::vector<std::shared_ptr<const std::string>> texts;
+        bool success = true;
         
-        if (fileText == nullptr)
+        for (const ShaderSource& source : sources)
+        {
+            ShaderCompUnit compUnit(kShaderStageMap[source.stage]);
+            
+            bool duplicate = std::any_of(compUnits.begin(), compUnits.end(), [&compUnit](const ShaderCompUnit& unit)
+                                         {
+                                             return unit.stage == compUnit.stage;
+                                         });
+            
+            if (duplicate)
+            {
+                printf("More than one shader given for the same stage: %s\n", source.path.c_str());
+                success = false;
+                break;
+            }
+            
+            // sources come from the include cache too, so recompiling an unchanged shader
+            // in a long running process reuses its buffer instead of reading it again
+            std::shared_ptr<const std::string> fileText = IncludeCache.read(source.path);
+            
+            if (!fileText)
+            {
+                printf("Failed to read shader source: %s\n", source.path.c_str());
+                success = false;
+                break;
+            }
+            
+            std::string path = source.path;
+            compUnit.addString(path, fileText->c_str());
+            
+            for (const std::string& define : source.defines)
+                compUnit.preamble.addDef(define);
+            
+            compUnits.push_back(compUnit);
+            texts.push_back(fileText);
+        }
+        
+        if (success)
+            CompileAndLinkShaderUnits(compUnits, IncludeCache, spirv);
+        
+        return success;
+    }
+    
+    //
+    // Reads the stage list of a '#pragma stages(vertex, fragment)' line.
+    //
+    bool ParseStagePragma(const char* text, std::vector<ShaderStage>& stages)
+    {
+        const char* kStageNames[] = { "vertex", "fragment", "compute" };
+        
+        std::istringstream source(text);
+        std::string line;
+        
+        while (std::getline(source, line))
+        {
+            std::istringstream tokens(line);
+            std::string directive, pragma;
+            
+            if (!(tokens >> directive) || directive != "#pragma")
+                continue;
+            
+            std::getline(tokens, pragma);
+            
+            size_t open = pragma.find("stages");
+            size_t begin = pragma.find('(', open);
+            size_t end = pragma.find(')', begin);
+            
+            if (open == std::string::npos || pragma.find_first_not_of(" \t") != open || begin == std::string::npos || end == std::string::npos)
+                continue;
+            
+            std::istringstream list(pragma.substr(begin + 1, end - begin - 1));
+            std::string name;
+            
+            while (std::getline(list, name, ','))
+            {
+                name.erase(0, name.find_first_not_of(" \t"));
+                name.erase(name.find_last_not_of(" \t") + 1);
+                
+                auto stage = std::find(std::begin(kStageNames), std::end(kStageNames), name);
+                
+                if (stage == std::end(kStageNames))
+                {
+                    printf("Unknown shader stage in #pragma stages: %s\n", name.c_str());
+                    return false;
+                }
+                
+                stages.push_back(ShaderStage(stage - std::begin(kStageNames)));
+            }
+            
+            return true;
+        }
+        
+        return false;
+    }
+    
+    //
+    // Single source mode: the file is read once and compiled for every stage, with the
+    // stage macro defined in each compilation unit's preamble. Includes come from the
+    // shared include cache, so they are read from disk once as well.
+    //
+    bool CompileShaderStages(const std::string& path, std::vector<ShaderStage>& stages, std::vector<std::vector<unsigned int>>& spirv)
+    {
+        std::shared_ptr<const std::string> fileText = IncludeCache.read(path);
+        
+        if (!fileText)
         {
             printf("Failed to read shader source: %s\n", path.c_str());
             return false;
         }
         
-        compUnit.addString(path, fileText);
+        if (stages.empty() && !ParseStagePragma(fileText->c_str(), stages))
+        {
+            printf("No shader stages specified and no #pragma stages found: %s\n", path.c_str());
+            return false;
+        }
         
-        CompileAndLinkShaderUnits(compUnit, spirv);
+        std::vector<ShaderCompUnit> compUnits;
         
-        // free memory from ReadFileData, which got stored in a const char*
-        // as the first string above
-        FreeFileData(const_cast<char*>(compUnit.text[0]));
+        for (ShaderStage stage : stages)
+        {
+            ShaderCompUnit compUnit(kShaderStageMap[stage]);
+            std::string fileName = path;
+            
+            compUnit.addString(fileName, fileText->c_str());
+            compUnit.preamble.addDef(kShaderStageMacros[stage]);
+            compUnits.push_back(compUnit);
+        }
+        
+        CompileAndLinkShaderUnits(compUnits, IncludeCache, spirv);
+        
+        return true;
+    }
+    
+    //
+    // Dependency scan mode: only runs the preprocessor, once per stage the shader would be
+    // compiled for, collecting the resolved includes and hashing the preprocessed text.
+    //
+    bool ScanShaderDependencies(const std::string& path, std::vector<ShaderStage> stages, ShaderDependencies& dependencies)
+    {
+        dependencies.path = path;
+        dependencies.includes.clear();
+        dependencies.hash = 0;
+        
+        std::shared_ptr<const std::string> source = IncludeCache.read(path);
+        
+        if (!source)
+        {
+            printf("Failed to read shader source: %s\n", path.c_str());
+            return false;
+        }
+        
+        // same rules as compile_stages: multi-stage sources get the stage macros defined
+        bool defineStages = stages.size() != 1;
+        
+        if (stages.empty() && !ParseStagePragma(source->c_str(), stages))
+        {
+            printf("No shader stages specified and no #pragma stages found: %s\n", path.c_str());
+            return false;
+        }
+        
+        EShMessages messages = ShaderMessages();
+        const int defaultVersion = Options & EOptionDefaultDesktop ? 110 : 100;
+        std::unordered_set<std::string> seen;
+        std::string preprocessed;
+        
+        for (ShaderStage stage : stages)
+        {
+            ShaderCompUnit compUnit(kShaderStageMap[stage]);
+            std::string fileName = path;
+            
+            compUnit.addString(fileName, source->c_str());
+            
+            if (defineStages)
+                compUnit.preamble.addDef(kShaderStageMacros[stage]);
+            
+            glslang::TShader shader(compUnit.stage);
+            shader.setStringsWithLengthsAndNames(compUnit.text, NULL, compUnit.fileNameList, compUnit.count);
+            std::string preamble = ShaderPreamble(compUnit);
+            ConfigureShader(shader, compUnit, preamble);
+            
+            std::vector<std::string> includes;
+            TRecordingFileIncluder includer(IncludeCache, includes);
+            
+            std::for_each(IncludeDirectoryList.rbegin(), IncludeDirectoryList.rend(), [&includer](const std::string& dir)
+                          {
+                              includer.pushExternalLocalDirectory(dir);
+                          });
+            
+            std::string output;
+            
+            if (!shader.preprocess(&Resources, defaultVersion, ENoProfile, false, false, messages, &output, includer))
+            {
+                PutsIfNonEmpty(path.c_str());
+                PutsIfNonEmpty(shader.getInfoLog());
+                return false;
+            }
+            
+            preprocessed += output;
+            preprocessed += '\0';
+            
+            for (const std::string& include : includes)
+            {
+                if (seen.insert(include).second)
+                    dependencies.includes.push_back(include);
+            }
+        }
+        
+        dependencies.hash = HashText(preprocessed);
         
         return true;
     }
@@ -516,56 +1010,91 @@ namespace spirv_compiler
         free(data);
     }
 
-    bool compile(const std::string& src, ShaderStage stage, std::vector<unsigned int>& spirv, bool vulkan_glsl)
+    bool compile(const std::string& src, ShaderStage stage, std::vector<unsigned int>& spirv, bool vulkan_glsl, bool enable_16bit_types, const std::vector<std::string>& defines)
     {
-        Resources = glslang::DefaultTBuiltInResource;
-
-		if (vulkan_glsl)
-		{
-			ClientVersion = glslang::EShTargetVulkan_1_1;
-			Client = glslang::EShClientVulkan;
-		}
-		else
-		{
-			if (Client == glslang::EShClientNone)
-				ClientVersion = glslang::EShTargetOpenGL_450;
-			Client = glslang::EShClientOpenGL;
-		}
+        // the caller's vector is swapped in as the single module, so callers that compile into
+        // the same vector every time keep its capacity
+        thread_local std::vector<std::vector<unsigned int>> stages(1);
         
-
-        Options |= EOptionSpv;
-        Options |= EOptionLinkProgram;
-        // undo a -H default to Vulkan
-        Options &= ~EOptionVulkanRules;
+        stages.resize(1);
+        stages[0].swap(spirv);
         
-        ClientInputSemanticsVersion = 450;
+        bool compiled = compile_program({ { src, stage, defines } }, stages, vulkan_glsl, enable_16bit_types);
+        
+        spirv.swap(stages[0]);
+        
+        return compiled;
+    }
+    
+    //
+    // Sets up the client and target environment for compiling to SPIR-V.
+    //
+    void SetupTarget(bool vulkan_glsl, bool enable_16bit_types)
+    {
+        Resources = glslang::DefaultTBuiltInResource;
+        Enable16BitTypes = enable_16bit_types;
+        HlslEnable16BitTypes = enable_16bit_types;
         
-        // rationalize client and target language
-        if (TargetLanguage == glslang::EShTargetNone)
+        // a thread compiles jobs with different settings one after another, so the whole
+        // target is set every time rather than only on the thread's first compile
+        if (vulkan_glsl)
         {
-            switch (ClientVersion)
-            {
-                case glslang::EShTargetVulkan_1_0:
-                    TargetLanguage = glslang::EShTargetSpv;
-                    TargetVersion = glslang::EShTargetSpv_1_0;
-                    break;
-                case glslang::EShTargetVulkan_1_1:
-                    TargetLanguage = glslang::EShTargetSpv;
-                    TargetVersion = glslang::EShTargetSpv_1_3;
-                    break;
-                case glslang::EShTargetOpenGL_450:
-                    TargetLanguage = glslang::EShTargetSpv;
-                    TargetVersion = glslang::EShTargetSpv_1_0;
-                    break;
-                default:
-                    break;
-            }
+            Client = glslang::EShClientVulkan;
+            ClientVersion = glslang::EShTargetVulkan_1_1;
+            TargetLanguage = glslang::EShTargetSpv;
+            TargetVersion = glslang::EShTargetSpv_1_3;
+        }
+        else
+        {
+            Client = glslang::EShClientOpenGL;
+            ClientVersion = glslang::EShTargetOpenGL_450;
+            TargetLanguage = glslang::EShTargetSpv;
+            TargetVersion = glslang::EShTargetSpv_1_0;
         }
         
+        Options = EOptionSpv | EOptionLinkProgram;
+        ClientInputSemanticsVersion = 450;
+    }
+    
+    bool compile_program(const std::vector<ShaderSource>& sources, std::vector<std::vector<unsigned int>>& spirv, bool vulkan_glsl, bool enable_16bit_types)
+    {
+        allocation_stats::ScopedStage allocation_stage(allocation_stats::STAGE_FRONTEND);
+        
+        CompileFailed = false;
+        LinkFailed = false;
+        
+        SetupTarget(vulkan_glsl, enable_16bit_types);
+        
         glslang::InitializeProcess();
-        CompileAndLinkShaderFiles(src, stage, spirv);
+        bool read = CompileAndLinkShaderFiles(sources, spirv);
         glslang::FinalizeProcess();
         
+        if (!read)
+            return false;
+        
+        if (CompileFailed)
+            return false;
+        if (LinkFailed)
+            return false;
+        
+        return true;
+    }
+    
+    bool compile_stages(const std::string& path, std::vector<ShaderStage>& stages, std::vector<std::vector<unsigned int>>& spirv, bool vulkan_glsl, bool enable_16bit_types)
+    {
+        allocation_stats::ScopedStage allocation_stage(allocation_stats::STAGE_FRONTEND);
+        
+        CompileFailed = false;
+        LinkFailed = false;
+        
+        SetupTarget(vulkan_glsl, enable_16bit_types);
+        
+        glslang::InitializeProcess();
+        bool read = CompileShaderStages(path, stages, spirv);
+        glslang::FinalizeProcess();
+        
+        if (!read)
+            return false;
         if (CompileFailed)
             return false;
         if (LinkFailed)
@@ -573,4 +1102,73 @@ namespace spirv_compiler
         
         return true;
     }
+    
+    bool prefetch(const std::string& path)
+    {
+        return IncludeCache.read(path) != nullptr;
+    }
+    
+    void include_cache_stats(IncludeCacheStats& stats)
+    {
+        IncludeCache.getStats(stats);
+    }
+    
+    void clear_include_cache()
+    {
+        IncludeCache.clear();
+    }
+    
+    bool scan_dependencies(const std::vector<std::string>& paths, const std::vector<ShaderStage>& stages, std::vector<ShaderDependencies>& dependencies, uint32_t thread_count, bool vulkan_glsl, bool enable_16bit_types)
+    {
+        if (thread_count == 0)
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+        
+        thread_count = std::min(thread_count, uint32_t(std::max<size_t>(paths.size(), 1)));
+        
+        dependencies.clear();
+        dependencies.resize(paths.size());
+        
+        std::atomic<size_t> next(0);
+        std::atomic<bool> success(true);
+        
+        auto worker = [&]()
+        {
+            allocation_stats::ScopedStage allocation_stage(allocation_stats::STAGE_FRONTEND);
+            SetupTarget(vulkan_glsl, enable_16bit_types);
+            
+            for (size_t i = next++; i < paths.size(); i = next++)
+            {
+                dependencies[i].success = ScanShaderDependencies(paths[i], stages, dependencies[i]);
+                
+                if (!dependencies[i].success)
+                    success = false;
+            }
+        };
+        
+        glslang::InitializeProcess();
+        
+        std::vector<std::thread> threads;
+        
+        for (uint32_t i = 1; i < thread_count; i++)
+            threads.push_back(std::thread(worker));
+        
+        worker();
+        
+        for (std::thread& thread : threads)
+            thread.join();
+        
+        glslang::FinalizeProcess();
+        
+        return success;
+    }
+    
+    void initialize()
+    {
+        glslang::InitializeProcess();
+    }
+    
+    void finalize()
+    {
+        glslang::FinalizeProcess();
+    }
 }
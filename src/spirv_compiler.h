@@ -2,6 +2,7 @@
 
 #include <string>
 #include <vector>
+#include <stdint.h>
 
 namespace spirv_compiler
 {
@@ -12,5 +13,58 @@ namespace spirv_compiler
         SHADER_STAGE_COMPUTE
     };
     
-    extern bool compile(const std::string& path, ShaderStage stage, std::vector<unsigned int>& spirv, bool vulkan_glsl = false);
+    struct ShaderSource
+    {
+        std::string path;
+        ShaderStage stage;
+        std::vector<std::string> defines;  // "NAME" or "NAME=VALUE", defined for this source only
+    };
+    
+    struct IncludeCacheStats
+    {
+        uint64_t hits;        // lookups served from memory, including unchanged files that were touched
+        uint64_t misses;      // lookups that read a new or modified file from disk
+        uint64_t bytes_read;
+        uint64_t files;
+    };
+    
+    struct ShaderDependencies
+    {
+        std::string path;
+        std::vector<std::string> includes;  // resolved include paths, in the order they were first seen
+        uint64_t hash;                      // hash of the preprocessed text of every stage
+        bool success;
+    };
+    
+    // Compiles from different threads run in parallel, except for the final SPIR-V
+    // generation of each module.
+    extern bool compile(const std::string& path, ShaderStage stage, std::vector<unsigned int>& spirv, bool vulkan_glsl = false, bool enable_16bit_types = false, const std::vector<std::string>& defines = std::vector<std::string>());
+    
+    // Compiles one shader per stage and links them into a single program, so the stage
+    // interfaces are checked against each other. 'spirv' receives one module per source.
+    extern bool compile_program(const std::vector<ShaderSource>& sources, std::vector<std::vector<unsigned int>>& spirv, bool vulkan_glsl = false, bool enable_16bit_types = false);
+    
+    // Compiles every stage in 'stages' from one source file, which is read once along with its
+    // includes. VERTEX, FRAGMENT or COMPUTE is defined for the stage being compiled. If 'stages'
+    // is empty it's filled from a '#pragma stages(vertex, fragment)' line in the source.
+    extern bool compile_stages(const std::string& path, std::vector<ShaderStage>& stages, std::vector<std::vector<unsigned int>>& spirv, bool vulkan_glsl = false, bool enable_16bit_types = false);
+    
+    // Runs only the preprocessor over each shader, in parallel on 'thread_count' threads (0 uses
+    // one per hardware thread). 'stages' follows the compile_stages rules: empty reads the
+    // '#pragma stages' line and more than one stage defines the stage macros.
+    extern bool scan_dependencies(const std::vector<std::string>& paths, const std::vector<ShaderStage>& stages, std::vector<ShaderDependencies>& dependencies, uint32_t thread_count = 0, bool vulkan_glsl = false, bool enable_16bit_types = false);
+    
+    // Reads a shader source into the include cache ahead of its compile. Returns false if
+    // the file can't be read.
+    extern bool prefetch(const std::string& path);
+    
+    // Includes are cached in memory across compiles and threads, and revalidated against each
+    // file's modification time, so the cache only needs clearing to release memory.
+    extern void include_cache_stats(IncludeCacheStats& stats);
+    extern void clear_include_cache();
+    
+    // Keeps glslang's process-wide state, such as the built-in symbol tables, alive between
+    // compiles so repeated compiles skip rebuilding it. Each call needs a matching finalize().
+    extern void initialize();
+    extern void finalize();
 }
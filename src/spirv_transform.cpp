@@ -0,0 +1,2314 @@
+#include "spirv_transform.h"
+
+#include <spirv.hpp>
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace spirv_transform
+{
+    const uint32_t kHeaderWordCount = 5;
+    const uint32_t kBoundWordIndex = 3;
+
+    struct Instruction
+    {
+        spv::Op op;
+        std::vector<uint32_t> words; // including the opcode/word count word
+    };
+
+    struct Module
+    {
+        std::vector<uint32_t> header;
+        std::vector<Instruction> instructions;
+    };
+
+    inline spv::Op instruction_op(uint32_t word)
+    {
+        return spv::Op(word & spv::OpCodeMask);
+    }
+
+    inline uint32_t instruction_word_count(uint32_t word)
+    {
+        return word >> spv::WordCountShift;
+    }
+
+    Instruction make_instruction(spv::Op op, std::initializer_list<uint32_t> operands)
+    {
+        Instruction inst;
+        inst.op = op;
+        inst.words.push_back(((uint32_t(operands.size()) + 1) << spv::WordCountShift) | op);
+        inst.words.insert(inst.words.end(), operands.begin(), operands.end());
+        return inst;
+    }
+
+    void fix_word_count(Instruction& inst)
+    {
+        inst.words[0] = (uint32_t(inst.words.size()) << spv::WordCountShift) | inst.op;
+    }
+
+    // Number of words taken up by the nul terminated literal string starting at 'start'.
+    uint32_t literal_string_word_count(const Instruction& inst, uint32_t start)
+    {
+        for (uint32_t i = start; i < inst.words.size(); i++)
+        {
+            uint32_t word = inst.words[i];
+
+            if ((word & 0xff) == 0 || (word & 0xff00) == 0 || (word & 0xff0000) == 0 || (word & 0xff000000) == 0)
+                return i - start + 1;
+        }
+
+        return uint32_t(inst.words.size()) - start;
+    }
+
+    bool is_annotation(spv::Op op)
+    {
+        return op == spv::OpDecorate || op == spv::OpMemberDecorate || op == spv::OpDecorationGroup ||
+               op == spv::OpGroupDecorate || op == spv::OpGroupMemberDecorate || op == spv::OpDecorateId ||
+               op == spv::OpDecorateStringGOOGLE || op == spv::OpMemberDecorateStringGOOGLE;
+    }
+
+    bool is_declaration(spv::Op op)
+    {
+        return (op >= spv::OpTypeVoid && op <= spv::OpTypeForwardPointer) ||
+               (op >= spv::OpConstantTrue && op <= spv::OpSpecConstantOp) ||
+               op == spv::OpVariable || op == spv::OpUndef || op == spv::OpFunction;
+    }
+
+    bool validate_header(const std::vector<unsigned int>& spirv)
+    {
+        if (spirv.size() < kHeaderWordCount)
+        {
+            printf("SPIR-V module is too small to contain a header!\n");
+            return false;
+        }
+
+        if (spirv[0] != spv::MagicNumber)
+        {
+            printf("Invalid SPIR-V magic number: 0x%08x\n", spirv[0]);
+            return false;
+        }
+
+        return true;
+    }
+
+    inline uint32_t swap_endianness(uint32_t word)
+    {
+        return (word >> 24) | ((word >> 8) & 0xff00) | ((word << 8) & 0xff0000) | (word << 24);
+    }
+
+    // Copies the words of a mapped SPIR-V file into 'spirv', byte swapping them if the module
+    // was written with the opposite endianness.
+    bool read_mapped_module(const void* data, size_t size, const std::string& path, std::vector<unsigned int>& spirv)
+    {
+        if (size % sizeof(uint32_t) != 0 || size < kHeaderWordCount * sizeof(uint32_t))
+        {
+            printf("%s is not a valid SPIR-V module!\n", path.c_str());
+            return false;
+        }
+
+        spirv.resize(size / sizeof(uint32_t));
+        memcpy(spirv.data(), data, size);
+
+        if (spirv[0] == swap_endianness(spv::MagicNumber))
+        {
+            for (unsigned int& word : spirv)
+                word = swap_endianness(word);
+        }
+
+        return validate_header(spirv);
+    }
+
+    bool load_module(const std::string& path, std::vector<unsigned int>& spirv)
+    {
+        bool loaded = false;
+
+#ifdef WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            printf("Failed to open %s\n", path.c_str());
+            return false;
+        }
+
+        LARGE_INTEGER size;
+        HANDLE mapping = GetFileSizeEx(file, &size) && size.QuadPart > 0 ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+        const void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+        if (data)
+        {
+            loaded = read_mapped_module(data, size_t(size.QuadPart), path, spirv);
+            UnmapViewOfFile(data);
+        }
+        else
+            printf("Failed to map %s\n", path.c_str());
+
+        if (mapping)
+            CloseHandle(mapping);
+
+        CloseHandle(file);
+#else
+        int file = open(path.c_str(), O_RDONLY);
+
+        if (file < 0)
+        {
+            printf("Failed to open %s\n", path.c_str());
+            return false;
+        }
+
+        struct stat info;
+        void* data = fstat(file, &info) == 0 && info.st_size > 0 ? mmap(NULL, size_t(info.st_size), PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+
+        if (data != MAP_FAILED)
+        {
+            loaded = read_mapped_module(data, size_t(info.st_size), path, spirv);
+            munmap(data, size_t(info.st_size));
+        }
+        else
+            printf("Failed to map %s\n", path.c_str());
+
+        close(file);
+#endif
+
+        return loaded;
+    }
+
+    bool parse_module(const std::vector<unsigned int>& spirv, Module& module)
+    {
+        if (!validate_header(spirv))
+            return false;
+
+        module.header.assign(spirv.begin(), spirv.begin() + kHeaderWordCount);
+        module.instructions.clear();
+
+        size_t offset = kHeaderWordCount;
+
+        while (offset < spirv.size())
+        {
+            uint32_t count = instruction_word_count(spirv[offset]);
+
+            if (count == 0 || offset + count > spirv.size())
+            {
+                printf("Malformed SPIR-V instruction at word %u\n", (uint32_t)offset);
+                return false;
+            }
+
+            Instruction inst;
+            inst.op = instruction_op(spirv[offset]);
+            inst.words.assign(spirv.begin() + offset, spirv.begin() + offset + count);
+            module.instructions.push_back(std::move(inst));
+
+            offset += count;
+        }
+
+        return true;
+    }
+
+    void write_module(const Module& module, std::vector<unsigned int>& spirv)
+    {
+        spirv.assign(module.header.begin(), module.header.end());
+
+        for (const Instruction& inst : module.instructions)
+            spirv.insert(spirv.end(), inst.words.begin(), inst.words.end());
+    }
+
+    uint32_t allocate_id(Module& module)
+    {
+        return module.header[kBoundWordIndex]++;
+    }
+
+    size_t first_annotation_index(const Module& module)
+    {
+        for (size_t i = 0; i < module.instructions.size(); i++)
+        {
+            spv::Op op = module.instructions[i].op;
+
+            if (op == spv::OpModuleProcessed || is_annotation(op) || is_declaration(op))
+                return i;
+        }
+
+        return module.instructions.size();
+    }
+
+    size_t first_declaration_index(const Module& module)
+    {
+        for (size_t i = 0; i < module.instructions.size(); i++)
+        {
+            if (is_declaration(module.instructions[i].op))
+                return i;
+        }
+
+        return module.instructions.size();
+    }
+
+    size_t first_function_index(const Module& module)
+    {
+        for (size_t i = 0; i < module.instructions.size(); i++)
+        {
+            if (module.instructions[i].op == spv::OpFunction)
+                return i;
+        }
+
+        return module.instructions.size();
+    }
+
+    // Returns the id of a type declaration matching 'op' and 'operands', declaring a new one
+    // right before the first function if the module does not have it yet.
+    uint32_t find_or_add_type(Module& module, spv::Op op, std::initializer_list<uint32_t> operands)
+    {
+        for (const Instruction& inst : module.instructions)
+        {
+            if (inst.op == op && inst.words.size() == operands.size() + 2 &&
+                std::equal(operands.begin(), operands.end(), inst.words.begin() + 2))
+                return inst.words[1];
+        }
+
+        uint32_t id = allocate_id(module);
+
+        Instruction inst;
+        inst.op = op;
+        inst.words.push_back(0);
+        inst.words.push_back(id);
+        inst.words.insert(inst.words.end(), operands.begin(), operands.end());
+        fix_word_count(inst);
+
+        module.instructions.insert(module.instructions.begin() + first_function_index(module), inst);
+
+        return id;
+    }
+
+    uint32_t find_or_add_constant(Module& module, uint32_t type_id, uint32_t value)
+    {
+        for (const Instruction& inst : module.instructions)
+        {
+            if (inst.op == spv::OpConstant && inst.words.size() == 4 && inst.words[1] == type_id && inst.words[3] == value)
+                return inst.words[2];
+        }
+
+        uint32_t id = allocate_id(module);
+        module.instructions.insert(module.instructions.begin() + first_function_index(module),
+                                   make_instruction(spv::OpConstant, { type_id, id, value }));
+
+        return id;
+    }
+
+    const Instruction* find_definition(const Module& module, uint32_t id)
+    {
+        for (const Instruction& inst : module.instructions)
+        {
+            if (is_declaration(inst.op) && inst.words.size() > 2)
+            {
+                bool result_first = inst.op >= spv::OpTypeVoid && inst.op <= spv::OpTypeForwardPointer;
+                uint32_t result_id = result_first ? inst.words[1] : inst.words[2];
+
+                if (result_id == id)
+                    return &inst;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // True if the struct is only referenced by Uniform pointer types, i.e. only uniform block
+    // variables use it, and by names and decorations.
+    bool is_uniform_block_only(const Module& module, uint32_t type_id)
+    {
+        for (const Instruction& inst : module.instructions)
+        {
+            if (inst.op == spv::OpName || inst.op == spv::OpMemberName || is_annotation(inst.op))
+                continue;
+
+            if (inst.op == spv::OpTypeStruct && inst.words[1] == type_id)
+                continue;
+
+            if (inst.op == spv::OpTypePointer && inst.words[3] == type_id && inst.words[2] == spv::StorageClassUniform)
+                continue;
+
+            // any other reference, e.g. a member of another struct, an array element or a
+            // pointer in another storage class, shares the layout being trimmed
+            if (std::find(inst.words.begin() + 1, inst.words.end(), type_id) != inst.words.end())
+                return false;
+        }
+
+        return true;
+    }
+
+    bool trim_struct_members(std::vector<unsigned int>& spirv, uint32_t type_id, uint32_t member_count)
+    {
+        Module module;
+
+        if (!parse_module(spirv, module))
+            return false;
+
+        if (!is_uniform_block_only(module, type_id))
+            return true;
+
+        std::vector<Instruction> instructions;
+        instructions.reserve(module.instructions.size());
+
+        for (Instruction& inst : module.instructions)
+        {
+            if (inst.op == spv::OpTypeStruct && inst.words[1] == type_id && inst.words.size() > member_count + 2)
+            {
+                // OpTypeStruct: result id followed by one word per member type
+                inst.words.resize(member_count + 2);
+                fix_word_count(inst);
+            }
+            else if ((inst.op == spv::OpMemberName || inst.op == spv::OpMemberDecorate || inst.op == spv::OpMemberDecorateStringGOOGLE) &&
+                     inst.words[1] == type_id && inst.words[2] >= member_count)
+                continue;
+
+            instructions.push_back(std::move(inst));
+        }
+
+        module.instructions.swap(instructions);
+        write_module(module, spirv);
+
+        return true;
+    }
+
+    // ------------------------------------------------------------------------------------------
+    // Dead code elimination
+    // ------------------------------------------------------------------------------------------
+
+    // Instructions without side effects, which can go away once their result is unused.
+    bool is_pure_op(spv::Op op)
+    {
+        return op == spv::OpExtInst || op == spv::OpLoad || op == spv::OpAccessChain || op == spv::OpInBoundsAccessChain ||
+               (op >= spv::OpVectorExtractDynamic && op <= spv::OpTranspose) ||
+               (op >= spv::OpSampledImage && op <= spv::OpImageRead) ||
+               (op >= spv::OpImage && op <= spv::OpImageQuerySamples) ||
+               (op >= spv::OpConvertFToU && op <= spv::OpBitcast) ||
+               (op >= spv::OpSNegate && op <= spv::OpFwidthCoarse) ||
+               op == spv::OpPhi;
+    }
+
+    // Collects the indices of the stores into 'id' and of the access chains they go through.
+    // Returns false if the variable is used in any other way.
+    bool find_store_only_accesses(const Module& module, uint32_t id, std::unordered_set<size_t>& accesses)
+    {
+        std::unordered_set<uint32_t> pointers = { id };
+
+        for (size_t i = first_function_index(module); i < module.instructions.size(); i++)
+        {
+            const Instruction& inst = module.instructions[i];
+
+            if (inst.op == spv::OpVariable && inst.words[2] == id)
+                continue;
+
+            bool uses_pointer = std::any_of(inst.words.begin() + 1, inst.words.end(), [&pointers](uint32_t word)
+                                            {
+                                                return pointers.count(word) != 0;
+                                            });
+
+            if (!uses_pointer)
+                continue;
+
+            if ((inst.op == spv::OpAccessChain || inst.op == spv::OpInBoundsAccessChain) && pointers.count(inst.words[3]) &&
+                std::none_of(inst.words.begin() + 4, inst.words.end(), [&pointers](uint32_t word) { return pointers.count(word) != 0; }))
+            {
+                pointers.insert(inst.words[2]);
+                accesses.insert(i);
+            }
+            else if (inst.op == spv::OpStore && pointers.count(inst.words[1]) && !pointers.count(inst.words[2]))
+                accesses.insert(i);
+            else
+                return false;
+        }
+
+        return true;
+    }
+
+    // Removes pure instructions whose result is never used and function variables that are
+    // only ever written, until nothing changes. Returns the number of removed instructions.
+    uint32_t eliminate_dead_code(Module& module)
+    {
+        uint32_t removed_count = 0;
+
+        while (true)
+        {
+            size_t begin = first_function_index(module);
+            std::unordered_map<uint32_t, uint32_t> uses;
+
+            // literal words may be miscounted as uses, which only keeps more code alive
+            for (size_t i = begin; i < module.instructions.size(); i++)
+            {
+                const Instruction& inst = module.instructions[i];
+                bool defines_result = is_pure_op(inst.op) || inst.op == spv::OpVariable;
+
+                for (size_t w = 1; w < inst.words.size(); w++)
+                {
+                    if (!(defines_result && w == 2))
+                        uses[inst.words[w]]++;
+                }
+            }
+
+            std::unordered_set<size_t> dead;
+
+            for (size_t i = begin; i < module.instructions.size(); i++)
+            {
+                const Instruction& inst = module.instructions[i];
+
+                if (is_pure_op(inst.op) && inst.words.size() > 2 && uses[inst.words[2]] == 0)
+                    dead.insert(i);
+                else if (inst.op == spv::OpVariable && inst.words[3] == spv::StorageClassFunction)
+                {
+                    std::unordered_set<size_t> accesses;
+
+                    if (find_store_only_accesses(module, inst.words[2], accesses))
+                    {
+                        dead.insert(i);
+                        dead.insert(accesses.begin(), accesses.end());
+                    }
+                }
+            }
+
+            if (dead.empty())
+                break;
+
+            std::unordered_set<uint32_t> removed_ids;
+            std::vector<Instruction> instructions;
+            instructions.reserve(module.instructions.size() - dead.size());
+
+            for (size_t i = 0; i < module.instructions.size(); i++)
+            {
+                Instruction& inst = module.instructions[i];
+
+                if (!dead.count(i))
+                    instructions.push_back(std::move(inst));
+                else if (inst.op != spv::OpStore)
+                    removed_ids.insert(inst.words[2]);
+            }
+
+            auto names_removed = std::remove_if(instructions.begin(), instructions.begin() + begin, [&removed_ids](const Instruction& inst)
+                                                {
+                                                    return (inst.op == spv::OpName || inst.op == spv::OpDecorate) && removed_ids.count(inst.words[1]);
+                                                });
+            instructions.erase(names_removed, instructions.begin() + begin);
+
+            module.instructions.swap(instructions);
+            removed_count += uint32_t(dead.size());
+        }
+
+        return removed_count;
+    }
+
+    // ------------------------------------------------------------------------------------------
+    // Varying packing
+    // ------------------------------------------------------------------------------------------
+
+    const uint32_t kInterpolationDecorations[] =
+    {
+        spv::DecorationRelaxedPrecision,
+        spv::DecorationNoPerspective,
+        spv::DecorationFlat,
+        spv::DecorationCentroid,
+        spv::DecorationSample
+    };
+
+    struct Varying
+    {
+        uint32_t id = 0;
+        uint32_t location = 0;
+        uint32_t components = 0;  // 0 if the varying can't be packed
+        uint32_t slots = 1;
+        uint32_t qualifiers = 0;  // bitmask of kInterpolationDecorations
+        std::string name;
+    };
+
+    // Collects the user defined stage interface variables of 'storage' keyed by location.
+    void find_varyings(const Module& module, spv::StorageClass storage, std::unordered_map<uint32_t, Varying>& varyings)
+    {
+        std::unordered_map<uint32_t, uint32_t> locations;
+        std::unordered_map<uint32_t, uint32_t> qualifiers;
+        std::unordered_map<uint32_t, std::string> names;
+        std::unordered_set<uint32_t> builtins;
+
+        for (const Instruction& inst : module.instructions)
+        {
+            if (inst.op == spv::OpName)
+                names[inst.words[1]] = std::string((const char*)&inst.words[2]);
+            else if (inst.op == spv::OpDecorate)
+            {
+                uint32_t decoration = inst.words[2];
+
+                if (decoration == spv::DecorationLocation)
+                    locations[inst.words[1]] = inst.words[3];
+                else if (decoration == spv::DecorationBuiltIn || decoration == spv::DecorationComponent ||
+                         decoration == spv::DecorationIndex)
+                    builtins.insert(inst.words[1]);
+
+                for (uint32_t i = 0; i < sizeof(kInterpolationDecorations) / sizeof(uint32_t); i++)
+                {
+                    if (decoration == kInterpolationDecorations[i])
+                        qualifiers[inst.words[1]] |= 1u << i;
+                }
+            }
+        }
+
+        for (const Instruction& inst : module.instructions)
+        {
+            if (inst.op != spv::OpVariable || inst.words[3] != uint32_t(storage))
+                continue;
+
+            uint32_t id = inst.words[2];
+
+            if (builtins.count(id) || !locations.count(id))
+                continue;
+
+            Varying varying;
+            varying.id = id;
+            varying.location = locations[id];
+            varying.qualifiers = qualifiers.count(id) ? qualifiers[id] : 0;
+            varying.name = names.count(id) ? names[id] : "";
+
+            // only scalar and vector 32-bit floats can share a vec4 slot
+            const Instruction* pointer = find_definition(module, inst.words[1]);
+            const Instruction* type = pointer ? find_definition(module, pointer->words[3]) : nullptr;
+
+            if (type && type->op == spv::OpTypeFloat && type->words[2] == 32)
+                varying.components = 1;
+            else if (type && type->op == spv::OpTypeVector && type->words[3] < 4)
+            {
+                const Instruction* component = find_definition(module, type->words[2]);
+
+                if (component && component->op == spv::OpTypeFloat && component->words[2] == 32)
+                    varying.components = type->words[3];
+            }
+            else if (type && type->op == spv::OpTypeMatrix)
+                varying.slots = type->words[3];
+            else if (type && type->op == spv::OpTypeArray)
+            {
+                const Instruction* length = find_definition(module, type->words[3]);
+                varying.slots = (length && length->op == spv::OpConstant) ? length->words[3] : 1;
+            }
+
+            varyings[varying.location] = varying;
+        }
+    }
+
+    // Checks that the variable is only ever loaded, stored or indexed with a constant, which are
+    // the accesses that get rewritten to the packed variable.
+    bool is_packable_access(const Module& module, uint32_t id)
+    {
+        size_t begin = first_function_index(module);
+
+        for (size_t i = begin; i < module.instructions.size(); i++)
+        {
+            const Instruction& inst = module.instructions[i];
+
+            if (std::find(inst.words.begin() + 1, inst.words.end(), id) == inst.words.end())
+                continue;
+
+            if (inst.op == spv::OpStore && inst.words[1] == id && inst.words[2] != id)
+                continue;
+
+            if (inst.op == spv::OpLoad && inst.words[3] == id)
+                continue;
+
+            if (inst.op == spv::OpAccessChain && inst.words.size() == 5 && inst.words[3] == id)
+            {
+                const Instruction* index = find_definition(module, inst.words[4]);
+
+                if (index && index->op == spv::OpConstant)
+                    continue;
+            }
+
+            return false;
+        }
+
+        return true;
+    }
+
+    struct PackedSlot
+    {
+        uint32_t location;
+        uint32_t qualifiers;
+        uint32_t used;
+        std::vector<Varying> varyings;
+        std::vector<uint32_t> components;
+    };
+
+    void remove_variables(Module& module, const std::unordered_set<uint32_t>& ids)
+    {
+        std::vector<Instruction> instructions;
+        instructions.reserve(module.instructions.size());
+
+        for (Instruction& inst : module.instructions)
+        {
+            if ((inst.op == spv::OpName || inst.op == spv::OpDecorate) && ids.count(inst.words[1]))
+                continue;
+
+            if (inst.op == spv::OpVariable && ids.count(inst.words[2]))
+                continue;
+
+            if (inst.op == spv::OpEntryPoint)
+            {
+                uint32_t interface_start = 3 + literal_string_word_count(inst, 3);
+                auto interface_end = std::remove_if(inst.words.begin() + interface_start, inst.words.end(), [&ids](uint32_t id)
+                                                    {
+                                                        return ids.count(id) != 0;
+                                                    });
+                inst.words.erase(interface_end, inst.words.end());
+                fix_word_count(inst);
+            }
+
+            instructions.push_back(std::move(inst));
+        }
+
+        module.instructions.swap(instructions);
+    }
+
+    // Replaces the varyings in 'slots' with one vec4 variable per slot and rewrites all
+    // loads and stores to access the packed components.
+    void apply_packing(Module& module, spv::StorageClass storage, const std::vector<PackedSlot>& slots)
+    {
+        uint32_t float_type = find_or_add_type(module, spv::OpTypeFloat, { 32 });
+        uint32_t vec4_type = find_or_add_type(module, spv::OpTypeVector, { float_type, 4 });
+        uint32_t vec4_pointer_type = find_or_add_type(module, spv::OpTypePointer, { uint32_t(storage), vec4_type });
+        uint32_t float_pointer_type = find_or_add_type(module, spv::OpTypePointer, { uint32_t(storage), float_type });
+        uint32_t int_type = find_or_add_type(module, spv::OpTypeInt, { 32, 1 });
+
+        uint32_t component_constants[4];
+
+        for (uint32_t i = 0; i < 4; i++)
+            component_constants[i] = find_or_add_constant(module, int_type, i);
+
+        // original variable -> (packed variable, first component)
+        std::unordered_map<uint32_t, std::pair<uint32_t, uint32_t>> remap;
+        std::unordered_set<uint32_t> removed;
+        std::vector<uint32_t> packed_ids;
+
+        for (size_t i = 0; i < slots.size(); i++)
+        {
+            const PackedSlot& slot = slots[i];
+            uint32_t id = allocate_id(module);
+
+            std::string name = "packed_varying_" + std::to_string(slot.location);
+            Instruction name_inst = make_instruction(spv::OpName, { id });
+            std::vector<uint32_t> name_words((name.size() + 4) / 4, 0);
+            memcpy(name_words.data(), name.c_str(), name.size());
+            name_inst.words.insert(name_inst.words.end(), name_words.begin(), name_words.end());
+            fix_word_count(name_inst);
+
+            module.instructions.insert(module.instructions.begin() + first_annotation_index(module), name_inst);
+            module.instructions.insert(module.instructions.begin() + first_declaration_index(module),
+                                       make_instruction(spv::OpDecorate, { id, spv::DecorationLocation, slot.location }));
+
+            for (uint32_t q = 0; q < sizeof(kInterpolationDecorations) / sizeof(uint32_t); q++)
+            {
+                if (slot.qualifiers & (1u << q))
+                    module.instructions.insert(module.instructions.begin() + first_declaration_index(module),
+                                               make_instruction(spv::OpDecorate, { id, kInterpolationDecorations[q] }));
+            }
+
+            module.instructions.insert(module.instructions.begin() + first_function_index(module),
+                                       make_instruction(spv::OpVariable, { vec4_pointer_type, id, uint32_t(storage) }));
+
+            for (size_t v = 0; v < slot.varyings.size(); v++)
+            {
+                remap[slot.varyings[v].id] = std::make_pair(id, slot.components[v]);
+                removed.insert(slot.varyings[v].id);
+            }
+
+            packed_ids.push_back(id);
+        }
+
+        for (Instruction& inst : module.instructions)
+        {
+            if (inst.op == spv::OpEntryPoint)
+            {
+                inst.words.insert(inst.words.end(), packed_ids.begin(), packed_ids.end());
+                fix_word_count(inst);
+            }
+        }
+
+        remove_variables(module, removed);
+
+        // component count of each original variable, looked up through its pointer type
+        std::unordered_map<uint32_t, uint32_t> component_counts;
+
+        for (const PackedSlot& slot : slots)
+        {
+            for (const Varying& varying : slot.varyings)
+                component_counts[varying.id] = varying.components;
+        }
+
+        std::unordered_map<uint32_t, uint32_t> constant_values;
+
+        for (const Instruction& inst : module.instructions)
+        {
+            if (inst.op == spv::OpConstant && inst.words.size() == 4)
+                constant_values[inst.words[2]] = inst.words[3];
+        }
+
+        std::vector<Instruction> instructions;
+        instructions.reserve(module.instructions.size());
+
+        for (Instruction& inst : module.instructions)
+        {
+            if (inst.op == spv::OpStore && remap.count(inst.words[1]))
+            {
+                auto packed = remap[inst.words[1]];
+                uint32_t components = component_counts[inst.words[1]];
+
+                for (uint32_t c = 0; c < components; c++)
+                {
+                    uint32_t value = inst.words[2];
+
+                    if (components > 1)
+                    {
+                        value = allocate_id(module);
+                        instructions.push_back(make_instruction(spv::OpCompositeExtract, { float_type, value, inst.words[2], c }));
+                    }
+
+                    uint32_t pointer = allocate_id(module);
+                    instructions.push_back(make_instruction(spv::OpAccessChain, { float_pointer_type, pointer, packed.first, component_constants[packed.second + c] }));
+                    instructions.push_back(make_instruction(spv::OpStore, { pointer, value }));
+                }
+            }
+            else if (inst.op == spv::OpLoad && remap.count(inst.words[3]))
+            {
+                auto packed = remap[inst.words[3]];
+                uint32_t components = component_counts[inst.words[3]];
+                std::vector<uint32_t> values;
+
+                for (uint32_t c = 0; c < components; c++)
+                {
+                    uint32_t pointer = allocate_id(module);
+                    uint32_t value = components > 1 ? allocate_id(module) : inst.words[2];
+
+                    instructions.push_back(make_instruction(spv::OpAccessChain, { float_pointer_type, pointer, packed.first, component_constants[packed.second + c] }));
+                    instructions.push_back(make_instruction(spv::OpLoad, { float_type, value, pointer }));
+                    values.push_back(value);
+                }
+
+                if (components > 1)
+                {
+                    Instruction construct = make_instruction(spv::OpCompositeConstruct, { inst.words[1], inst.words[2] });
+                    construct.words.insert(construct.words.end(), values.begin(), values.end());
+                    fix_word_count(construct);
+                    instructions.push_back(construct);
+                }
+            }
+            else if (inst.op == spv::OpAccessChain && remap.count(inst.words[3]))
+            {
+                auto packed = remap[inst.words[3]];
+                uint32_t component = packed.second + constant_values[inst.words[4]];
+
+                instructions.push_back(make_instruction(spv::OpAccessChain, { inst.words[1], inst.words[2], packed.first, component_constants[component] }));
+            }
+            else
+                instructions.push_back(std::move(inst));
+        }
+
+        module.instructions.swap(instructions);
+    }
+
+    bool pack_varyings(std::vector<unsigned int>& vertex_spirv, std::vector<unsigned int>& fragment_spirv, VaryingPackingReport& report)
+    {
+        Module vertex;
+        Module fragment;
+
+        if (!parse_module(vertex_spirv, vertex) || !parse_module(fragment_spirv, fragment))
+            return false;
+
+        std::unordered_map<uint32_t, Varying> outputs;
+        std::unordered_map<uint32_t, Varying> inputs;
+
+        find_varyings(vertex, spv::StorageClassOutput, outputs);
+        find_varyings(fragment, spv::StorageClassInput, inputs);
+
+        std::vector<Varying> packable;
+        std::unordered_set<uint32_t> reserved_locations;
+
+        report.slots_before = 0;
+        report.slots_after = 0;
+        report.varyings.clear();
+
+        std::vector<uint32_t> output_locations;
+
+        for (auto& output : outputs)
+            output_locations.push_back(output.first);
+
+        std::sort(output_locations.begin(), output_locations.end());
+
+        for (uint32_t location : output_locations)
+        {
+            Varying& varying = outputs[location];
+            auto input = inputs.find(location);
+
+            report.slots_before += varying.slots;
+
+            bool compatible = input != inputs.end() && varying.components > 0 &&
+                              varying.components == input->second.components &&
+                              is_packable_access(vertex, varying.id) && is_packable_access(fragment, input->second.id);
+
+            if (compatible)
+            {
+                // interpolation qualifiers may be declared on either side
+                varying.qualifiers |= input->second.qualifiers;
+                packable.push_back(varying);
+            }
+            else
+            {
+                for (uint32_t s = 0; s < varying.slots; s++)
+                    reserved_locations.insert(varying.location + s);
+            }
+        }
+
+        // fragment inputs without a matching output still occupy their location
+        for (auto& input : inputs)
+        {
+            if (outputs.find(input.first) == outputs.end())
+            {
+                for (uint32_t s = 0; s < input.second.slots; s++)
+                    reserved_locations.insert(input.second.location + s);
+            }
+        }
+
+        // first fit, largest varyings first
+        std::sort(packable.begin(), packable.end(), [](const Varying& a, const Varying& b)
+                  {
+                      if (a.components != b.components)
+                          return a.components > b.components;
+                      return a.location < b.location;
+                  });
+
+        std::vector<PackedSlot> slots;
+
+        for (const Varying& varying : packable)
+        {
+            PackedSlot* target = nullptr;
+
+            for (PackedSlot& slot : slots)
+            {
+                if (slot.qualifiers == varying.qualifiers && slot.used + varying.components <= 4)
+                {
+                    target = &slot;
+                    break;
+                }
+            }
+
+            if (!target)
+            {
+                slots.push_back(PackedSlot());
+                target = &slots.back();
+                target->location = 0;
+                target->qualifiers = varying.qualifiers;
+                target->used = 0;
+            }
+
+            target->varyings.push_back(varying);
+            target->components.push_back(target->used);
+            target->used += varying.components;
+        }
+
+        // varyings that end up alone in a slot are left as they are
+        std::vector<PackedSlot> packed_slots;
+
+        for (PackedSlot& slot : slots)
+        {
+            if (slot.varyings.size() > 1)
+                packed_slots.push_back(slot);
+            else
+                reserved_locations.insert(slot.varyings[0].location);
+        }
+
+        uint32_t next_location = 0;
+
+        for (PackedSlot& slot : packed_slots)
+        {
+            while (reserved_locations.count(next_location))
+                next_location++;
+
+            slot.location = next_location++;
+        }
+
+        report.slots_after = uint32_t(reserved_locations.size() + packed_slots.size());
+
+        for (const PackedSlot& slot : packed_slots)
+        {
+            const char* swizzle = "xyzw";
+
+            for (size_t v = 0; v < slot.varyings.size(); v++)
+            {
+                PackedVarying packed;
+
+                packed.name = slot.varyings[v].name;
+                packed.location = slot.varyings[v].location;
+                packed.slot = slot.location;
+                packed.component = slot.components[v];
+                packed.components = slot.varyings[v].components;
+                packed.swizzle = std::string(swizzle + packed.component, packed.components);
+
+                report.varyings.push_back(packed);
+            }
+        }
+
+        if (packed_slots.empty())
+            return true;
+
+        // the fragment side uses its own variable ids for the same locations
+        std::vector<PackedSlot> fragment_slots = packed_slots;
+
+        for (PackedSlot& slot : fragment_slots)
+        {
+            for (Varying& varying : slot.varyings)
+                varying.id = inputs[varying.location].id;
+        }
+
+        apply_packing(vertex, spv::StorageClassOutput, packed_slots);
+        apply_packing(fragment, spv::StorageClassInput, fragment_slots);
+
+        write_module(vertex, vertex_spirv);
+        write_module(fragment, fragment_spirv);
+
+        return true;
+    }
+
+    // ------------------------------------------------------------------------------------------
+    // Cross-stage interface elimination
+    // ------------------------------------------------------------------------------------------
+
+    struct InterfaceVariable
+    {
+        uint32_t id;
+        uint32_t location;
+        uint32_t slots;
+        std::string name;
+    };
+
+    // All stage interface variables of 'storage' with an explicit location, including the ones
+    // find_varyings skips because they carry a component decoration.
+    void find_interface_variables(const Module& module, spv::StorageClass storage, std::vector<InterfaceVariable>& variables)
+    {
+        std::unordered_map<uint32_t, Varying> varyings;
+        find_varyings(module, storage, varyings);
+
+        std::unordered_map<uint32_t, uint32_t> locations;
+        std::unordered_map<uint32_t, std::string> names;
+
+        for (const Instruction& inst : module.instructions)
+        {
+            if (inst.op == spv::OpName)
+                names[inst.words[1]] = std::string((const char*)&inst.words[2]);
+            else if (inst.op == spv::OpDecorate && inst.words[2] == spv::DecorationLocation)
+                locations[inst.words[1]] = inst.words[3];
+        }
+
+        for (const Instruction& inst : module.instructions)
+        {
+            if (inst.op != spv::OpVariable || inst.words[3] != uint32_t(storage) || !locations.count(inst.words[2]))
+                continue;
+
+            InterfaceVariable variable;
+            variable.id = inst.words[2];
+            variable.location = locations[variable.id];
+            variable.name = names.count(variable.id) ? names[variable.id] : "";
+
+            auto varying = varyings.find(variable.location);
+            variable.slots = (varying != varyings.end() && varying->second.id == variable.id) ? varying->second.slots : 1;
+
+            variables.push_back(variable);
+        }
+    }
+
+    bool is_variable_used(const Module& module, uint32_t id)
+    {
+        for (size_t i = first_function_index(module); i < module.instructions.size(); i++)
+        {
+            const Instruction& inst = module.instructions[i];
+
+            if (std::find(inst.words.begin() + 1, inst.words.end(), id) != inst.words.end())
+                return true;
+        }
+
+        return false;
+    }
+
+    bool eliminate_dead_varyings(std::vector<unsigned int>& producer_spirv, std::vector<unsigned int>& consumer_spirv, InterfaceReport& report)
+    {
+        Module producer;
+        Module consumer;
+
+        if (!parse_module(producer_spirv, producer) || !parse_module(consumer_spirv, consumer))
+            return false;
+
+        report.outputs.clear();
+        report.inputs.clear();
+        report.instructions_removed = 0;
+
+        std::vector<InterfaceVariable> inputs;
+        std::vector<InterfaceVariable> live_inputs;
+        std::unordered_set<uint32_t> dead_inputs;
+
+        find_interface_variables(consumer, spv::StorageClassInput, inputs);
+
+        for (const InterfaceVariable& input : inputs)
+        {
+            if (is_variable_used(consumer, input.id))
+                live_inputs.push_back(input);
+            else
+            {
+                dead_inputs.insert(input.id);
+                report.inputs.push_back(input.name.empty() ? "location " + std::to_string(input.location) : input.name);
+            }
+        }
+
+        std::vector<InterfaceVariable> outputs;
+        std::unordered_set<uint32_t> dead_outputs;
+        std::unordered_set<size_t> dead_stores;
+
+        find_interface_variables(producer, spv::StorageClassOutput, outputs);
+
+        for (const InterfaceVariable& output : outputs)
+        {
+            bool consumed = std::any_of(live_inputs.begin(), live_inputs.end(), [&output](const InterfaceVariable& input)
+                                        {
+                                            return input.location < output.location + output.slots &&
+                                                   output.location < input.location + input.slots;
+                                        });
+
+            // outputs the producer reads back are left alone
+            std::unordered_set<size_t> accesses;
+
+            if (consumed || !find_store_only_accesses(producer, output.id, accesses))
+                continue;
+
+            dead_outputs.insert(output.id);
+            dead_stores.insert(accesses.begin(), accesses.end());
+            report.outputs.push_back(output.name.empty() ? "location " + std::to_string(output.location) : output.name);
+        }
+
+        if (!dead_outputs.empty())
+        {
+            std::vector<Instruction> instructions;
+            instructions.reserve(producer.instructions.size());
+
+            for (size_t i = 0; i < producer.instructions.size(); i++)
+            {
+                if (!dead_stores.count(i))
+                    instructions.push_back(std::move(producer.instructions[i]));
+            }
+
+            producer.instructions.swap(instructions);
+            report.instructions_removed += uint32_t(dead_stores.size());
+
+            remove_variables(producer, dead_outputs);
+            report.instructions_removed += eliminate_dead_code(producer);
+        }
+
+        if (!dead_inputs.empty())
+            remove_variables(consumer, dead_inputs);
+
+        write_module(producer, producer_spirv);
+        write_module(consumer, consumer_spirv);
+
+        return true;
+    }
+
+    // ------------------------------------------------------------------------------------------
+    // Precision relaxation
+    // ------------------------------------------------------------------------------------------
+
+    const uint32_t kPrecisionSink = ~0u;
+    const uint32_t kPrecisionBlock = ~0u - 1;
+
+    bool is_relaxable_op(spv::Op op)
+    {
+        switch (op)
+        {
+            case spv::OpLoad:
+            case spv::OpFNegate:
+            case spv::OpFAdd:
+            case spv::OpFSub:
+            case spv::OpFMul:
+            case spv::OpFDiv:
+            case spv::OpFRem:
+            case spv::OpFMod:
+            case spv::OpVectorTimesScalar:
+            case spv::OpMatrixTimesScalar:
+            case spv::OpVectorTimesMatrix:
+            case spv::OpMatrixTimesVector:
+            case spv::OpMatrixTimesMatrix:
+            case spv::OpDot:
+            case spv::OpExtInst:
+            case spv::OpCompositeConstruct:
+            case spv::OpCompositeExtract:
+            case spv::OpCompositeInsert:
+            case spv::OpVectorShuffle:
+            case spv::OpCopyObject:
+            case spv::OpSelect:
+            case spv::OpPhi:
+            case spv::OpImageSampleImplicitLod:
+            case spv::OpImageSampleExplicitLod:
+            case spv::OpImageSampleProjImplicitLod:
+            case spv::OpImageSampleProjExplicitLod:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    bool is_image_sample_op(spv::Op op)
+    {
+        return op >= spv::OpImageSampleImplicitLod && op <= spv::OpImageSampleProjDrefExplicitLod;
+    }
+
+    // Index of the first id operand of a relaxable instruction and the index past the last one,
+    // skipping the literal words some of them carry.
+    void relaxable_operand_range(const Instruction& inst, uint32_t& begin, uint32_t& end)
+    {
+        begin = 3;
+        end = uint32_t(inst.words.size());
+
+        if (inst.op == spv::OpExtInst)
+            begin = 5;
+        else if (inst.op == spv::OpCompositeExtract)
+            end = 4;
+        else if (inst.op == spv::OpCompositeInsert || inst.op == spv::OpVectorShuffle)
+            end = 5;
+    }
+
+    bool relax_precision(std::vector<unsigned int>& spirv, PrecisionReport& report)
+    {
+        Module module;
+
+        if (!parse_module(spirv, module))
+            return false;
+
+        report.variables.clear();
+        report.temporaries = 0;
+
+        bool is_fragment = false;
+        std::unordered_set<uint32_t> float_types;
+        std::unordered_map<uint32_t, uint32_t> pointer_types;  // pointer type -> pointee type
+        std::unordered_map<uint32_t, uint32_t> variable_storage;
+        std::unordered_set<uint32_t> builtins;
+        std::unordered_set<uint32_t> relaxed;
+        std::unordered_map<uint32_t, std::string> names;
+
+        for (const Instruction& inst : module.instructions)
+        {
+            if (inst.op == spv::OpEntryPoint)
+                is_fragment = inst.words[1] == spv::ExecutionModelFragment;
+            else if (inst.op == spv::OpName)
+                names[inst.words[1]] = std::string((const char*)&inst.words[2]);
+            else if (inst.op == spv::OpDecorate && inst.words[2] == spv::DecorationBuiltIn)
+                builtins.insert(inst.words[1]);
+            else if (inst.op == spv::OpDecorate && inst.words[2] == spv::DecorationRelaxedPrecision)
+                relaxed.insert(inst.words[1]);
+            else if (inst.op == spv::OpTypeFloat && inst.words[2] == 32)
+                float_types.insert(inst.words[1]);
+            else if ((inst.op == spv::OpTypeVector || inst.op == spv::OpTypeMatrix) && float_types.count(inst.words[2]))
+                float_types.insert(inst.words[1]);
+            else if (inst.op == spv::OpTypePointer)
+                pointer_types[inst.words[1]] = inst.words[3];
+            else if (inst.op == spv::OpVariable)
+                variable_storage[inst.words[2]] = inst.words[3];
+        }
+
+        /* every candidate id records who consumes it: another candidate,
+         a color output / texture coordinate (sink), or anything else (block)
+         */
+        std::unordered_map<uint32_t, std::vector<uint32_t>> consumers;
+        std::unordered_map<uint32_t, uint32_t> pointer_roots;
+
+        for (const Instruction& inst : module.instructions)
+        {
+            if (inst.op == spv::OpVariable && inst.words[3] == spv::StorageClassFunction && float_types.count(pointer_types[inst.words[1]]))
+                consumers[inst.words[2]];
+            else if (is_relaxable_op(inst.op) && float_types.count(inst.words[1]))
+                consumers[inst.words[2]];
+        }
+
+        auto consume = [&consumers](uint32_t id, uint32_t consumer)
+        {
+            auto node = consumers.find(id);
+
+            if (node != consumers.end())
+                node->second.push_back(consumer);
+        };
+
+        for (size_t i = first_function_index(module); i < module.instructions.size(); i++)
+        {
+            const Instruction& inst = module.instructions[i];
+
+            if (inst.op == spv::OpAccessChain || inst.op == spv::OpInBoundsAccessChain)
+            {
+                uint32_t base = inst.words[3];
+                pointer_roots[inst.words[2]] = pointer_roots.count(base) ? pointer_roots[base] : base;
+
+                for (size_t w = 4; w < inst.words.size(); w++)
+                    consume(inst.words[w], kPrecisionBlock);
+            }
+            else if (inst.op == spv::OpStore)
+            {
+                uint32_t root = pointer_roots.count(inst.words[1]) ? pointer_roots[inst.words[1]] : inst.words[1];
+                bool color_output = is_fragment && variable_storage.count(root) &&
+                                    variable_storage[root] == spv::StorageClassOutput && !builtins.count(root);
+
+                if (color_output)
+                    consume(inst.words[2], kPrecisionSink);
+                else if (consumers.count(root))
+                    consume(inst.words[2], root);
+                else
+                    consume(inst.words[2], kPrecisionBlock);
+            }
+            else if (inst.op == spv::OpLoad)
+            {
+                uint32_t root = pointer_roots.count(inst.words[3]) ? pointer_roots[inst.words[3]] : inst.words[3];
+                consume(root, consumers.count(inst.words[2]) ? inst.words[2] : kPrecisionBlock);
+            }
+            else if (is_image_sample_op(inst.op))
+            {
+                consume(inst.words[4], kPrecisionSink);
+
+                for (size_t w = 5; w < inst.words.size(); w++)
+                    consume(inst.words[w], kPrecisionBlock);
+            }
+            else if (is_relaxable_op(inst.op) && consumers.count(inst.words[2]))
+            {
+                uint32_t begin, end;
+                relaxable_operand_range(inst, begin, end);
+
+                for (uint32_t w = begin; w < end; w++)
+                    consume(inst.words[w], inst.words[2]);
+            }
+            else
+            {
+                for (size_t w = 1; w < inst.words.size(); w++)
+                    consume(inst.words[w], kPrecisionBlock);
+            }
+        }
+
+        // iterate to a fixed point, dropping candidates with any consumer that isn't relaxed
+        std::unordered_set<uint32_t> candidates;
+
+        for (auto& node : consumers)
+        {
+            if (!node.second.empty() && !relaxed.count(node.first))
+                candidates.insert(node.first);
+        }
+
+        bool changed = true;
+
+        while (changed)
+        {
+            changed = false;
+
+            for (auto it = candidates.begin(); it != candidates.end();)
+            {
+                bool keep = true;
+
+                for (uint32_t consumer : consumers[*it])
+                {
+                    if (consumer == kPrecisionSink || candidates.count(consumer) || relaxed.count(consumer))
+                        continue;
+
+                    keep = false;
+                    break;
+                }
+
+                if (keep)
+                    ++it;
+                else
+                {
+                    it = candidates.erase(it);
+                    changed = true;
+                }
+            }
+        }
+
+        if (candidates.empty())
+            return true;
+
+        std::vector<uint32_t> demoted(candidates.begin(), candidates.end());
+        std::sort(demoted.begin(), demoted.end());
+
+        size_t insert_index = first_declaration_index(module);
+
+        for (uint32_t id : demoted)
+        {
+            module.instructions.insert(module.instructions.begin() + insert_index++,
+                                       make_instruction(spv::OpDecorate, { id, spv::DecorationRelaxedPrecision }));
+
+            if (variable_storage.count(id) && names.count(id) && !names[id].empty())
+                report.variables.push_back(names[id]);
+            else
+                report.temporaries++;
+        }
+
+        write_module(module, spirv);
+
+        return true;
+    }
+
+    // ------------------------------------------------------------------------------------------
+    // Specialization constants
+    // ------------------------------------------------------------------------------------------
+
+    enum ScalarKind
+    {
+        SCALAR_BOOL,
+        SCALAR_INT,
+        SCALAR_UINT,
+        SCALAR_FLOAT
+    };
+
+    struct ScalarValue
+    {
+        ScalarKind kind;
+        uint32_t bits;
+    };
+
+    struct ConstantTable
+    {
+        std::unordered_map<uint32_t, ScalarKind> scalar_types;
+        std::unordered_map<uint32_t, ScalarValue> values;   // constants and temporaries folded to one
+        std::unordered_map<uint64_t, uint32_t> ids;         // (type, bits) -> constant id
+        std::unordered_map<uint32_t, uint32_t> undefs;      // type -> OpUndef id
+        std::vector<Instruction> declarations;              // not yet inserted into the module
+    };
+
+    inline float float_from_bits(uint32_t bits)
+    {
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    inline uint32_t bits_from_float(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    inline uint64_t constant_key(uint32_t type_id, uint32_t bits)
+    {
+        return (uint64_t(type_id) << 32) | bits;
+    }
+
+    uint32_t scalar_bits(ScalarKind kind, double value)
+    {
+        switch (kind)
+        {
+            case SCALAR_BOOL:
+                return value != 0.0 ? 1 : 0;
+            case SCALAR_INT:
+                return uint32_t(int32_t(value));
+            case SCALAR_UINT:
+                return uint32_t(value);
+            default:
+                return bits_from_float(float(value));
+        }
+    }
+
+    void record_constant(ConstantTable& table, const Instruction& inst)
+    {
+        if (inst.words.size() < 3 || !table.scalar_types.count(inst.words[1]))
+            return;
+
+        uint32_t type_id = inst.words[1];
+        uint32_t bits;
+
+        if (inst.op == spv::OpConstantTrue || inst.op == spv::OpConstantFalse)
+            bits = inst.op == spv::OpConstantTrue ? 1 : 0;
+        else if (inst.op == spv::OpConstant && inst.words.size() == 4)
+            bits = inst.words[3];
+        else if (inst.op == spv::OpConstantNull)
+            bits = 0;
+        else
+            return;
+
+        table.values[inst.words[2]] = { table.scalar_types[type_id], bits };
+
+        if (inst.op != spv::OpConstantNull && !table.ids.count(constant_key(type_id, bits)))
+            table.ids[constant_key(type_id, bits)] = inst.words[2];
+    }
+
+    Instruction make_scalar_constant(ScalarKind kind, uint32_t type_id, uint32_t id, uint32_t bits)
+    {
+        if (kind == SCALAR_BOOL)
+            return make_instruction(bits ? spv::OpConstantTrue : spv::OpConstantFalse, { type_id, id });
+
+        return make_instruction(spv::OpConstant, { type_id, id, bits });
+    }
+
+    uint32_t get_scalar_constant(Module& module, ConstantTable& table, uint32_t type_id, uint32_t bits)
+    {
+        auto existing = table.ids.find(constant_key(type_id, bits));
+
+        if (existing != table.ids.end())
+            return existing->second;
+
+        uint32_t id = allocate_id(module);
+
+        table.declarations.push_back(make_scalar_constant(table.scalar_types[type_id], type_id, id, bits));
+        record_constant(table, table.declarations.back());
+
+        return id;
+    }
+
+    uint32_t get_undef(Module& module, ConstantTable& table, uint32_t type_id)
+    {
+        auto existing = table.undefs.find(type_id);
+
+        if (existing != table.undefs.end())
+            return existing->second;
+
+        uint32_t id = allocate_id(module);
+
+        table.declarations.push_back(make_instruction(spv::OpUndef, { type_id, id }));
+        table.undefs[type_id] = id;
+
+        return id;
+    }
+
+    void flush_declarations(Module& module, ConstantTable& table)
+    {
+        module.instructions.insert(module.instructions.begin() + first_function_index(module),
+                                   table.declarations.begin(), table.declarations.end());
+        table.declarations.clear();
+    }
+
+    // Evaluates a 32-bit scalar instruction whose operands are all known. Returns false for
+    // anything it doesn't handle or that would be undefined (division by zero, large shifts).
+    bool fold_scalar(spv::Op op, const std::vector<ScalarValue>& operands, uint32_t& result)
+    {
+        if (operands.size() == 1)
+        {
+            uint32_t a = operands[0].bits;
+
+            switch (op)
+            {
+                case spv::OpSNegate: result = uint32_t(-int64_t(int32_t(a))); return true;
+                case spv::OpNot: result = ~a; return true;
+                case spv::OpLogicalNot: result = a ? 0 : 1; return true;
+                case spv::OpFNegate: result = bits_from_float(-float_from_bits(a)); return true;
+                case spv::OpConvertSToF: result = bits_from_float(float(int32_t(a))); return true;
+                case spv::OpConvertUToF: result = bits_from_float(float(a)); return true;
+                case spv::OpConvertFToS: result = uint32_t(int32_t(float_from_bits(a))); return true;
+                case spv::OpConvertFToU: result = uint32_t(float_from_bits(a)); return true;
+                default: return false;
+            }
+        }
+        else if (operands.size() == 2)
+        {
+            uint32_t a = operands[0].bits;
+            uint32_t b = operands[1].bits;
+            int32_t sa = int32_t(a);
+            int32_t sb = int32_t(b);
+            float fa = float_from_bits(a);
+            float fb = float_from_bits(b);
+
+            switch (op)
+            {
+                case spv::OpIAdd: result = a + b; return true;
+                case spv::OpISub: result = a - b; return true;
+                case spv::OpIMul: result = a * b; return true;
+                case spv::OpUDiv:
+                    if (b == 0)
+                        return false;
+                    result = a / b;
+                    return true;
+                case spv::OpUMod:
+                    if (b == 0)
+                        return false;
+                    result = a % b;
+                    return true;
+                case spv::OpSDiv:
+                case spv::OpSRem:
+                case spv::OpSMod:
+                    if (sb == 0 || (sa == INT32_MIN && sb == -1))
+                        return false;
+                    if (op == spv::OpSDiv)
+                        result = uint32_t(sa / sb);
+                    else if (op == spv::OpSRem || sa % sb == 0 || (sa < 0) == (sb < 0))
+                        result = uint32_t(sa % sb);
+                    else
+                        result = uint32_t(sa % sb + sb); // OpSMod takes the sign of the divisor
+                    return true;
+                case spv::OpShiftLeftLogical:
+                case spv::OpShiftRightLogical:
+                case spv::OpShiftRightArithmetic:
+                    if (b >= 32)
+                        return false;
+                    if (op == spv::OpShiftLeftLogical)
+                        result = a << b;
+                    else if (op == spv::OpShiftRightLogical)
+                        result = a >> b;
+                    else
+                        result = uint32_t(sa >> b);
+                    return true;
+                case spv::OpBitwiseAnd: result = a & b; return true;
+                case spv::OpBitwiseOr: result = a | b; return true;
+                case spv::OpBitwiseXor: result = a ^ b; return true;
+                case spv::OpLogicalAnd: result = (a && b) ? 1 : 0; return true;
+                case spv::OpLogicalOr: result = (a || b) ? 1 : 0; return true;
+                case spv::OpLogicalEqual: result = (!a == !b) ? 1 : 0; return true;
+                case spv::OpLogicalNotEqual: result = (!a != !b) ? 1 : 0; return true;
+                case spv::OpIEqual: result = a == b ? 1 : 0; return true;
+                case spv::OpINotEqual: result = a != b ? 1 : 0; return true;
+                case spv::OpUGreaterThan: result = a > b ? 1 : 0; return true;
+                case spv::OpUGreaterThanEqual: result = a >= b ? 1 : 0; return true;
+                case spv::OpULessThan: result = a < b ? 1 : 0; return true;
+                case spv::OpULessThanEqual: result = a <= b ? 1 : 0; return true;
+                case spv::OpSGreaterThan: result = sa > sb ? 1 : 0; return true;
+                case spv::OpSGreaterThanEqual: result = sa >= sb ? 1 : 0; return true;
+                case spv::OpSLessThan: result = sa < sb ? 1 : 0; return true;
+                case spv::OpSLessThanEqual: result = sa <= sb ? 1 : 0; return true;
+                case spv::OpFAdd: result = bits_from_float(fa + fb); return true;
+                case spv::OpFSub: result = bits_from_float(fa - fb); return true;
+                case spv::OpFMul: result = bits_from_float(fa * fb); return true;
+                case spv::OpFDiv:
+                    if (fb == 0.0f)
+                        return false;
+                    result = bits_from_float(fa / fb);
+                    return true;
+                case spv::OpFOrdEqual: result = fa == fb ? 1 : 0; return true;
+                case spv::OpFOrdNotEqual: result = (fa < fb || fa > fb) ? 1 : 0; return true;
+                case spv::OpFOrdLessThan: result = fa < fb ? 1 : 0; return true;
+                case spv::OpFOrdGreaterThan: result = fa > fb ? 1 : 0; return true;
+                case spv::OpFOrdLessThanEqual: result = fa <= fb ? 1 : 0; return true;
+                case spv::OpFOrdGreaterThanEqual: result = fa >= fb ? 1 : 0; return true;
+                default: return false;
+            }
+        }
+        else if (operands.size() == 3 && op == spv::OpSelect)
+        {
+            result = operands[0].bits ? operands[1].bits : operands[2].bits;
+            return true;
+        }
+
+        return false;
+    }
+
+    // Looks up the known values of the id operands in [begin, end), returning false if any
+    // of them isn't a scalar constant.
+    bool constant_operands(const ConstantTable& table, const Instruction& inst, size_t begin, std::vector<ScalarValue>& operands)
+    {
+        operands.clear();
+
+        for (size_t w = begin; w < inst.words.size(); w++)
+        {
+            auto value = table.values.find(inst.words[w]);
+
+            if (value == table.values.end())
+                return false;
+
+            operands.push_back(value->second);
+        }
+
+        return true;
+    }
+
+    void freeze_spec_constants(Module& module, ConstantTable& table, const std::vector<SpecializationConstant>& constants, SpecializationReport& report)
+    {
+        std::unordered_map<uint32_t, uint32_t> spec_ids;  // constant -> constant_id
+
+        for (const Instruction& inst : module.instructions)
+        {
+            if (inst.op == spv::OpDecorate && inst.words[2] == spv::DecorationSpecId)
+                spec_ids[inst.words[1]] = inst.words[3];
+            else if (inst.op == spv::OpTypeBool)
+                table.scalar_types[inst.words[1]] = SCALAR_BOOL;
+            else if (inst.op == spv::OpTypeInt && inst.words[2] == 32)
+                table.scalar_types[inst.words[1]] = inst.words[3] ? SCALAR_INT : SCALAR_UINT;
+            else if (inst.op == spv::OpTypeFloat && inst.words[2] == 32)
+                table.scalar_types[inst.words[1]] = SCALAR_FLOAT;
+        }
+
+        std::unordered_map<uint32_t, double> overrides;
+
+        for (const SpecializationConstant& constant : constants)
+        {
+            bool declared = false;
+
+            for (auto& spec_id : spec_ids)
+                declared = declared || spec_id.second == constant.constant_id;
+
+            if (!declared)
+                printf("WARNING: Specialization constant %u is not declared by the shader\n", constant.constant_id);
+
+            overrides[constant.constant_id] = constant.value;
+        }
+
+        std::vector<Instruction> instructions;
+        instructions.reserve(module.instructions.size());
+
+        std::vector<ScalarValue> operands;
+
+        for (Instruction& inst : module.instructions)
+        {
+            if (inst.op == spv::OpDecorate && inst.words[2] == spv::DecorationSpecId)
+                continue;
+
+            if (inst.op == spv::OpSpecConstantTrue || inst.op == spv::OpSpecConstantFalse || inst.op == spv::OpSpecConstant)
+            {
+                uint32_t type_id = inst.words[1];
+                uint32_t id = inst.words[2];
+                auto spec_id = spec_ids.find(id);
+                auto value = spec_id != spec_ids.end() ? overrides.find(spec_id->second) : overrides.end();
+
+                if (inst.op == spv::OpSpecConstant)
+                {
+                    inst.op = spv::OpConstant;
+
+                    if (value != overrides.end() && inst.words.size() == 4 && table.scalar_types.count(type_id))
+                        inst.words[3] = scalar_bits(table.scalar_types[type_id], value->second);
+
+                    fix_word_count(inst);
+                }
+                else
+                {
+                    bool enabled = value != overrides.end() ? value->second != 0.0 : inst.op == spv::OpSpecConstantTrue;
+                    inst = make_instruction(enabled ? spv::OpConstantTrue : spv::OpConstantFalse, { type_id, id });
+                }
+
+                report.constants_frozen++;
+            }
+            else if (inst.op == spv::OpSpecConstantComposite)
+            {
+                inst.op = spv::OpConstantComposite;
+                fix_word_count(inst);
+            }
+            else if (inst.op == spv::OpSpecConstantOp && table.scalar_types.count(inst.words[1]))
+            {
+                // OpSpecConstantOp: result type, result id, opcode literal, operands
+                uint32_t bits;
+
+                if (constant_operands(table, inst, 4, operands) && fold_scalar(spv::Op(inst.words[3]), operands, bits))
+                    inst = make_scalar_constant(table.scalar_types[inst.words[1]], inst.words[1], inst.words[2], bits);
+            }
+
+            record_constant(table, inst);
+            instructions.push_back(std::move(inst));
+        }
+
+        module.instructions.swap(instructions);
+    }
+
+    // Replaces scalar instructions whose operands are all constants with a copy of the
+    // folded constant and lets the copies propagate into the instructions that use them.
+    void fold_function_constants(Module& module, ConstantTable& table, SpecializationReport& report)
+    {
+        std::vector<ScalarValue> operands;
+
+        for (size_t i = first_function_index(module); i < module.instructions.size(); i++)
+        {
+            Instruction& inst = module.instructions[i];
+
+            if (inst.words.size() < 4 || table.values.count(inst.words[2]))
+                continue;
+
+            uint32_t type_id = inst.words[1];
+            uint32_t id = inst.words[2];
+
+            if (inst.op == spv::OpCopyObject)
+            {
+                auto value = table.values.find(inst.words[3]);
+
+                if (value != table.values.end())
+                    table.values[id] = value->second;
+            }
+            else if (inst.op == spv::OpSelect && table.values.count(inst.words[3]) && table.values[inst.words[3]].kind == SCALAR_BOOL)
+            {
+                // the condition alone decides a select, whatever the type of its operands
+                uint32_t chosen = table.values[inst.words[3]].bits ? inst.words[4] : inst.words[5];
+                inst = make_instruction(spv::OpCopyObject, { type_id, id, chosen });
+                i--;
+                report.instructions_folded++;
+            }
+            else if (table.scalar_types.count(type_id))
+            {
+                uint32_t bits;
+
+                if (!constant_operands(table, inst, 3, operands) || !fold_scalar(inst.op, operands, bits))
+                    continue;
+
+                inst = make_instruction(spv::OpCopyObject, { type_id, id, get_scalar_constant(module, table, type_id, bits) });
+                table.values[id] = { table.scalar_types[type_id], bits };
+                report.instructions_folded++;
+            }
+        }
+    }
+
+    struct Block
+    {
+        uint32_t label;
+        size_t begin;  // OpLabel
+        size_t end;    // past the terminator
+    };
+
+    bool is_block_terminator(spv::Op op)
+    {
+        return op == spv::OpBranch || op == spv::OpBranchConditional || op == spv::OpSwitch || op == spv::OpReturn ||
+               op == spv::OpReturnValue || op == spv::OpKill || op == spv::OpUnreachable;
+    }
+
+    void block_successors(const Instruction& terminator, std::vector<uint32_t>& successors)
+    {
+        successors.clear();
+
+        if (terminator.op == spv::OpBranch)
+            successors.push_back(terminator.words[1]);
+        else if (terminator.op == spv::OpBranchConditional)
+        {
+            successors.push_back(terminator.words[2]);
+            successors.push_back(terminator.words[3]);
+        }
+        else if (terminator.op == spv::OpSwitch)
+        {
+            // selector, default, then (literal, label) pairs for 32-bit selectors
+            successors.push_back(terminator.words[2]);
+
+            for (size_t w = 4; w < terminator.words.size(); w += 2)
+                successors.push_back(terminator.words[w]);
+        }
+    }
+
+    // Resolves the branches of if/switch constructs with a constant condition and drops the
+    // blocks that become unreachable. Merge and continue blocks that are still named by a live
+    // construct are kept as empty blocks. Returns true if anything changed.
+    bool eliminate_dead_branches(Module& module, ConstantTable& table, SpecializationReport& report)
+    {
+        std::vector<Instruction> instructions;
+        instructions.reserve(module.instructions.size());
+
+        bool changed = false;
+        size_t i = 0;
+
+        std::vector<uint32_t> successors;
+
+        while (i < module.instructions.size())
+        {
+            if (module.instructions[i].op != spv::OpFunction)
+            {
+                instructions.push_back(std::move(module.instructions[i++]));
+                continue;
+            }
+
+            while (module.instructions[i].op != spv::OpLabel && module.instructions[i].op != spv::OpFunctionEnd)
+                instructions.push_back(std::move(module.instructions[i++]));
+
+            std::vector<Block> blocks;
+            std::unordered_map<uint32_t, size_t> block_indices;
+
+            while (module.instructions[i].op == spv::OpLabel)
+            {
+                Block block;
+                block.label = module.instructions[i].words[1];
+                block.begin = i;
+
+                while (!is_block_terminator(module.instructions[i].op))
+                    i++;
+
+                block.end = ++i;
+                block_indices[block.label] = blocks.size();
+                blocks.push_back(block);
+            }
+
+            std::unordered_set<size_t> removed_merges;
+
+            for (const Block& block : blocks)
+            {
+                Instruction& terminator = module.instructions[block.end - 1];
+                size_t merge = block.end - 2;
+
+                if (merge <= block.begin || module.instructions[merge].op != spv::OpSelectionMerge)
+                    continue;
+
+                if (terminator.op == spv::OpBranchConditional && table.values.count(terminator.words[1]))
+                {
+                    uint32_t target = table.values[terminator.words[1]].bits ? terminator.words[2] : terminator.words[3];
+
+                    terminator = make_instruction(spv::OpBranch, { target });
+                    removed_merges.insert(merge);
+                    report.branches_eliminated++;
+                }
+                else if (terminator.op == spv::OpSwitch && terminator.words.size() > 3 && table.values.count(terminator.words[1]))
+                {
+                    // keep the construct, but leave the selected case as the only target
+                    uint32_t selector = terminator.words[1];
+                    uint32_t target = terminator.words[2];
+
+                    for (size_t w = 3; w + 1 < terminator.words.size(); w += 2)
+                    {
+                        if (terminator.words[w] == table.values[selector].bits)
+                            target = terminator.words[w + 1];
+                    }
+
+                    terminator = make_instruction(spv::OpSwitch, { selector, target });
+                    report.branches_eliminated++;
+                }
+            }
+
+            changed = changed || !removed_merges.empty();
+
+            std::unordered_set<uint32_t> reachable;
+            std::vector<uint32_t> worklist;
+
+            if (!blocks.empty())
+            {
+                reachable.insert(blocks[0].label);
+                worklist.push_back(blocks[0].label);
+            }
+
+            while (!worklist.empty())
+            {
+                const Block& block = blocks[block_indices[worklist.back()]];
+                worklist.pop_back();
+
+                block_successors(module.instructions[block.end - 1], successors);
+
+                for (uint32_t successor : successors)
+                {
+                    if (reachable.insert(successor).second)
+                        worklist.push_back(successor);
+                }
+            }
+
+            // merge/continue targets of live constructs have to stay, even when unreachable
+            std::unordered_map<uint32_t, uint32_t> structural;  // label -> loop header, or 0 for merge blocks
+
+            for (const Block& block : blocks)
+            {
+                size_t merge = block.end - 2;
+
+                if (!reachable.count(block.label) || merge <= block.begin || removed_merges.count(merge))
+                    continue;
+
+                const Instruction& inst = module.instructions[merge];
+
+                if (inst.op == spv::OpLoopMerge)
+                {
+                    structural[inst.words[2]] = block.label;
+                    structural.insert(std::make_pair(inst.words[1], 0u));
+                }
+                else if (inst.op == spv::OpSelectionMerge)
+                    structural.insert(std::make_pair(inst.words[1], 0u));
+            }
+
+            std::unordered_map<uint32_t, std::unordered_set<uint32_t>> predecessors;
+            std::unordered_set<uint32_t> emptied;
+
+            for (const Block& block : blocks)
+            {
+                if (reachable.count(block.label))
+                {
+                    block_successors(module.instructions[block.end - 1], successors);
+
+                    for (uint32_t successor : successors)
+                        predecessors[successor].insert(block.label);
+                }
+                else if (structural.count(block.label))
+                {
+                    emptied.insert(block.label);
+
+                    if (structural[block.label] != 0)
+                        predecessors[structural[block.label]].insert(block.label);
+                }
+            }
+
+            for (const Block& block : blocks)
+            {
+                if (!reachable.count(block.label))
+                {
+                    changed = true;
+                    report.blocks_removed++;
+
+                    if (emptied.count(block.label))
+                    {
+                        // an unreachable continue block still has to branch back to its loop header
+                        instructions.push_back(std::move(module.instructions[block.begin]));
+
+                        if (structural[block.label] != 0)
+                            instructions.push_back(make_instruction(spv::OpBranch, { structural[block.label] }));
+                        else
+                            instructions.push_back(make_instruction(spv::OpUnreachable, {}));
+                    }
+
+                    continue;
+                }
+
+                const std::unordered_set<uint32_t>& block_predecessors = predecessors[block.label];
+
+                for (size_t b = block.begin; b < block.end; b++)
+                {
+                    Instruction& inst = module.instructions[b];
+
+                    if (removed_merges.count(b))
+                        continue;
+
+                    if (inst.op != spv::OpPhi)
+                    {
+                        instructions.push_back(std::move(inst));
+                        continue;
+                    }
+
+                    // OpPhi: result type, result id, then (value, parent) pairs
+                    Instruction phi = make_instruction(spv::OpPhi, { inst.words[1], inst.words[2] });
+
+                    for (size_t w = 3; w + 1 < inst.words.size(); w += 2)
+                    {
+                        uint32_t value = inst.words[w];
+                        uint32_t parent = inst.words[w + 1];
+
+                        if (!block_predecessors.count(parent))
+                            continue;
+
+                        if (emptied.count(parent) && !table.values.count(value))
+                            value = get_undef(module, table, inst.words[1]);
+
+                        phi.words.push_back(value);
+                        phi.words.push_back(parent);
+                    }
+
+                    fix_word_count(phi);
+
+                    if (phi.words.size() == 5)
+                        phi = make_instruction(spv::OpCopyObject, { inst.words[1], inst.words[2], phi.words[3] });
+
+                    changed = changed || phi.words != inst.words;
+                    instructions.push_back(std::move(phi));
+                }
+            }
+
+            instructions.push_back(std::move(module.instructions[i++]));  // OpFunctionEnd
+        }
+
+        module.instructions.swap(instructions);
+
+        return changed;
+    }
+
+    bool specialize_constants(std::vector<unsigned int>& spirv, const std::vector<SpecializationConstant>& constants, SpecializationReport& report)
+    {
+        Module module;
+
+        if (!parse_module(spirv, module))
+            return false;
+
+        report.constants_frozen = 0;
+        report.instructions_folded = 0;
+        report.branches_eliminated = 0;
+        report.blocks_removed = 0;
+
+        ConstantTable table;
+
+        freeze_spec_constants(module, table, constants, report);
+
+        // removing a branch can turn phis into constants, which may resolve further branches
+        const int kMaxIterations = 8;
+
+        for (int iteration = 0; iteration < kMaxIterations; iteration++)
+        {
+            fold_function_constants(module, table, report);
+            flush_declarations(module, table);
+
+            bool changed = eliminate_dead_branches(module, table, report);
+            flush_declarations(module, table);
+
+            if (!changed)
+                break;
+        }
+
+        write_module(module, spirv);
+
+        return true;
+    }
+
+    // ------------------------------------------------------------------------------------------
+    // Cost analysis
+    // ------------------------------------------------------------------------------------------
+
+    // GLSL.std.450 instruction numbers
+    const uint32_t kGLSLstd450Sin = 13;
+    const uint32_t kGLSLstd450InverseSqrt = 32;
+
+    bool has_result_type(spv::Op op)
+    {
+        switch (op)
+        {
+            case spv::OpNop:
+            case spv::OpLine:
+            case spv::OpNoLine:
+            case spv::OpStore:
+            case spv::OpCopyMemory:
+            case spv::OpCopyMemorySized:
+            case spv::OpImageWrite:
+            case spv::OpEmitVertex:
+            case spv::OpEndPrimitive:
+            case spv::OpControlBarrier:
+            case spv::OpMemoryBarrier:
+            case spv::OpAtomicStore:
+            case spv::OpLoopMerge:
+            case spv::OpSelectionMerge:
+            case spv::OpLabel:
+            case spv::OpLifetimeStart:
+            case spv::OpLifetimeStop:
+            case spv::OpFunction:
+            case spv::OpFunctionEnd:
+                return false;
+            default:
+                return !is_block_terminator(op);
+        }
+    }
+
+    bool is_float_alu_op(spv::Op op)
+    {
+        return (op >= spv::OpConvertFToU && op <= spv::OpConvertUToF) || op == spv::OpFConvert || op == spv::OpQuantizeToF16 ||
+               op == spv::OpFNegate || op == spv::OpFAdd || op == spv::OpFSub || op == spv::OpFMul || op == spv::OpFDiv ||
+               (op >= spv::OpFRem && op <= spv::OpDot) || (op >= spv::OpIsNan && op <= spv::OpIsInf) ||
+               (op >= spv::OpFOrdEqual && op <= spv::OpFUnordGreaterThanEqual) || (op >= spv::OpDPdx && op <= spv::OpFwidthCoarse);
+    }
+
+    bool is_int_alu_op(spv::Op op)
+    {
+        return op == spv::OpUConvert || op == spv::OpSConvert || op == spv::OpSNegate || op == spv::OpIAdd || op == spv::OpISub ||
+               op == spv::OpIMul || op == spv::OpUDiv || op == spv::OpSDiv || op == spv::OpUMod || op == spv::OpSRem || op == spv::OpSMod ||
+               (op >= spv::OpIEqual && op <= spv::OpSLessThanEqual) || (op >= spv::OpShiftRightLogical && op <= spv::OpBitCount);
+    }
+
+    struct FunctionCost
+    {
+        ShaderCost cost;
+        std::vector<std::pair<uint32_t, uint32_t>> calls;  // callee, values live across the call
+        bool analyzed = false;
+    };
+
+    // Peak number of overlapping live ranges, where a value lives from its definition to its
+    // last use and values used inside a loop stay live until the loop's merge block.
+    uint32_t estimate_live_values(const Module& module, size_t begin, size_t end, std::vector<std::pair<uint32_t, uint32_t>>& calls,
+                                  const std::unordered_set<uint32_t>& void_types)
+    {
+        std::unordered_map<uint32_t, size_t> definitions;
+        std::unordered_map<uint32_t, size_t> last_uses;
+        std::unordered_map<uint32_t, size_t> labels;
+        std::vector<std::pair<size_t, uint32_t>> loops;  // header index, merge label
+
+        uint32_t last_label = 0;
+
+        for (size_t i = begin; i < end; i++)
+        {
+            const Instruction& inst = module.instructions[i];
+            size_t first_use = 1;
+
+            if (inst.op == spv::OpLabel)
+            {
+                labels[inst.words[1]] = i;
+                last_label = inst.words[1];
+                continue;
+            }
+
+            if (inst.op == spv::OpLoopMerge)
+                loops.push_back(std::make_pair(labels[last_label], inst.words[1]));
+
+            if (has_result_type(inst.op) && inst.words.size() > 2)
+            {
+                if (inst.op != spv::OpVariable && !void_types.count(inst.words[1]))
+                    definitions[inst.words[2]] = i;
+
+                first_use = 3;
+            }
+
+            for (size_t w = first_use; w < inst.words.size(); w++)
+                last_uses[inst.words[w]] = i;
+        }
+
+        std::vector<std::pair<size_t, size_t>> ranges;
+
+        for (auto& definition : definitions)
+        {
+            auto last_use = last_uses.find(definition.first);
+
+            if (last_use == last_uses.end())
+                continue;
+
+            size_t first = std::min(definition.second, last_use->second);
+            size_t last = std::max(definition.second, last_use->second);
+
+            for (auto& loop : loops)
+            {
+                size_t loop_end = labels.count(loop.second) ? labels[loop.second] : end;
+
+                if (first < loop.first && last >= loop.first && last < loop_end)
+                    last = loop_end;
+            }
+
+            ranges.push_back(std::make_pair(first, last));
+        }
+
+        // sweep over range starts and ends
+        std::vector<std::pair<size_t, int>> events;
+
+        for (auto& range : ranges)
+        {
+            events.push_back(std::make_pair(range.first, 1));
+            events.push_back(std::make_pair(range.second + 1, -1));
+        }
+
+        std::sort(events.begin(), events.end());
+
+        uint32_t live = 0;
+        uint32_t max_live = 0;
+        size_t next_event = 0;
+
+        for (size_t i = begin; i < end; i++)
+        {
+            while (next_event < events.size() && events[next_event].first <= i)
+                live += events[next_event++].second;
+
+            max_live = std::max(max_live, live);
+
+            const Instruction& inst = module.instructions[i];
+
+            if (inst.op == spv::OpFunctionCall)
+                calls.push_back(std::make_pair(inst.words[3], live));
+        }
+
+        return max_live;
+    }
+
+    void analyze_function(const Module& module, size_t begin, size_t end, uint32_t glsl_ext, const std::unordered_set<uint32_t>& float_types,
+                          const std::unordered_set<uint32_t>& void_types, FunctionCost& function)
+    {
+        ShaderCost& cost = function.cost;
+
+        cost.float_alu = 0;
+        cost.int_alu = 0;
+        cost.transcendental = 0;
+        cost.texture_samples = 0;
+        cost.branches = 0;
+        cost.loops = 0;
+
+        for (size_t i = begin; i < end; i++)
+        {
+            const Instruction& inst = module.instructions[i];
+
+            if (inst.op == spv::OpExtInst && inst.words[3] == glsl_ext)
+            {
+                if (inst.words[4] >= kGLSLstd450Sin && inst.words[4] <= kGLSLstd450InverseSqrt)
+                    cost.transcendental++;
+                else if (float_types.count(inst.words[1]))
+                    cost.float_alu++;
+                else
+                    cost.int_alu++;
+            }
+            else if (is_image_sample_op(inst.op) || (inst.op >= spv::OpImageFetch && inst.op <= spv::OpImageRead))
+                cost.texture_samples++;
+            else if (inst.op == spv::OpBranchConditional || inst.op == spv::OpSwitch)
+                cost.branches++;
+            else if (inst.op == spv::OpLoopMerge)
+                cost.loops++;
+            else if (is_float_alu_op(inst.op))
+                cost.float_alu++;
+            else if (is_int_alu_op(inst.op))
+                cost.int_alu++;
+        }
+
+        cost.max_live_values = estimate_live_values(module, begin, end, function.calls, void_types);
+    }
+
+    // Adds the cost of every call to the caller. SPIR-V doesn't allow recursion, so this terminates.
+    const ShaderCost& accumulate_calls(std::unordered_map<uint32_t, FunctionCost>& functions, uint32_t id)
+    {
+        FunctionCost& function = functions[id];
+
+        if (function.analyzed)
+            return function.cost;
+
+        function.analyzed = true;
+
+        for (auto& call : function.calls)
+        {
+            if (!functions.count(call.first))
+                continue;
+
+            const ShaderCost& callee = accumulate_calls(functions, call.first);
+
+            function.cost.float_alu += callee.float_alu;
+            function.cost.int_alu += callee.int_alu;
+            function.cost.transcendental += callee.transcendental;
+            function.cost.texture_samples += callee.texture_samples;
+            function.cost.branches += callee.branches;
+            function.cost.loops += callee.loops;
+            function.cost.max_live_values = std::max(function.cost.max_live_values, callee.max_live_values + call.second);
+        }
+
+        return function.cost;
+    }
+
+    bool analyze_cost(const std::vector<unsigned int>& spirv, std::vector<ShaderCost>& costs)
+    {
+        Module module;
+
+        if (!parse_module(spirv, module))
+            return false;
+
+        uint32_t glsl_ext = 0;
+        std::unordered_set<uint32_t> float_types;
+        std::unordered_set<uint32_t> void_types;
+        std::vector<std::pair<uint32_t, std::string>> entry_points;
+
+        for (const Instruction& inst : module.instructions)
+        {
+            if (inst.op == spv::OpExtInstImport && std::string((const char*)&inst.words[2]) == "GLSL.std.450")
+                glsl_ext = inst.words[1];
+            else if (inst.op == spv::OpEntryPoint)
+                entry_points.push_back(std::make_pair(inst.words[2], std::string((const char*)&inst.words[3])));
+            else if (inst.op == spv::OpTypeFloat)
+                float_types.insert(inst.words[1]);
+            else if ((inst.op == spv::OpTypeVector || inst.op == spv::OpTypeMatrix) && float_types.count(inst.words[2]))
+                float_types.insert(inst.words[1]);
+            else if (inst.op == spv::OpTypeVoid)
+                void_types.insert(inst.words[1]);
+        }
+
+        std::unordered_map<uint32_t, FunctionCost> functions;
+
+        for (size_t i = first_function_index(module); i < module.instructions.size(); i++)
+        {
+            if (module.instructions[i].op != spv::OpFunction)
+                continue;
+
+            size_t end = i;
+
+            while (end < module.instructions.size() && module.instructions[end].op != spv::OpFunctionEnd)
+                end++;
+
+            analyze_function(module, i + 1, end, glsl_ext, float_types, void_types, functions[module.instructions[i].words[2]]);
+            i = end;
+        }
+
+        costs.clear();
+
+        for (auto& entry_point : entry_points)
+        {
+            if (!functions.count(entry_point.first))
+                continue;
+
+            ShaderCost cost = accumulate_calls(functions, entry_point.first);
+            cost.entry_point = entry_point.second;
+            costs.push_back(cost);
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+namespace spirv_transform
+{
+    struct PackedVarying
+    {
+        std::string name;
+        uint32_t location;   // location before packing
+        uint32_t slot;       // location of the packed vec4
+        uint32_t component;  // first component within the packed vec4
+        uint32_t components;
+        std::string swizzle;
+    };
+
+    struct VaryingPackingReport
+    {
+        uint32_t slots_before;
+        uint32_t slots_after;
+        std::vector<PackedVarying> varyings;
+    };
+
+    struct PrecisionReport
+    {
+        std::vector<std::string> variables;  // named local variables that were demoted
+        uint32_t temporaries;
+    };
+
+    struct SpecializationConstant
+    {
+        uint32_t constant_id;
+        double value;  // converted to the declared bool/int/uint/float type of the constant
+    };
+
+    struct SpecializationReport
+    {
+        uint32_t constants_frozen;
+        uint32_t instructions_folded;
+        uint32_t branches_eliminated;
+        uint32_t blocks_removed;
+    };
+
+    struct InterfaceReport
+    {
+        std::vector<std::string> outputs;  // producer outputs removed
+        std::vector<std::string> inputs;   // consumer inputs removed
+        uint32_t instructions_removed;
+    };
+
+    struct ShaderCost
+    {
+        std::string entry_point;
+        uint32_t float_alu;
+        uint32_t int_alu;
+        uint32_t transcendental;    // GLSL.std.450 trigonometric, exp/log, pow and sqrt functions
+        uint32_t texture_samples;   // samples, fetches, gathers and image reads
+        uint32_t branches;
+        uint32_t loops;
+        uint32_t max_live_values;   // estimated peak number of values live at the same time
+    };
+
+    // Returns true if the module starts with a valid SPIR-V header.
+    extern bool validate_header(const std::vector<unsigned int>& spirv);
+
+    // Memory maps a SPIR-V binary and copies it into 'spirv' in host byte order. Fails if the
+    // file doesn't start with the SPIR-V magic number in either endianness.
+    extern bool load_module(const std::string& path, std::vector<unsigned int>& spirv);
+
+    // Removes the members of struct 'type_id' starting at index 'member_count', along with
+    // their names and decorations. The offsets of the remaining members are left untouched.
+    // Structs used by anything other than uniform block variables are left as they are.
+    extern bool trim_struct_members(std::vector<unsigned int>& spirv, uint32_t type_id, uint32_t member_count);
+
+    // Packs the float and vec2/vec3 varyings shared by a vertex and fragment shader into
+    // vec4 slots, rewriting both modules so they access matching swizzles of the packed
+    // variables. Varyings with different interpolation qualifiers never share a slot.
+    extern bool pack_varyings(std::vector<unsigned int>& vertex_spirv, std::vector<unsigned int>& fragment_spirv, VaryingPackingReport& report);
+
+    // Decorates float locals and temporaries with RelaxedPrecision when their values only end
+    // up in fragment color outputs or texture coordinates.
+    extern bool relax_precision(std::vector<unsigned int>& spirv, PrecisionReport& report);
+
+    // Removes the consumer inputs that are never read and the producer outputs no remaining
+    // consumer input overlaps, along with the producer instructions that only fed them.
+    extern bool eliminate_dead_varyings(std::vector<unsigned int>& producer_spirv, std::vector<unsigned int>& consumer_spirv, InterfaceReport& report);
+
+    // Turns specialization constants into regular constants, using the values in 'constants'
+    // and the declared defaults for the rest, then folds the scalar instructions that only
+    // depend on constants and removes the if/switch paths that can no longer be taken.
+    extern bool specialize_constants(std::vector<unsigned int>& spirv, const std::vector<SpecializationConstant>& constants, SpecializationReport& report);
+
+    // Estimates the static cost of every entry point. Instructions in called functions are
+    // counted once per call site.
+    extern bool analyze_cost(const std::vector<unsigned int>& spirv, std::vector<ShaderCost>& costs);
+}
@@ -0,0 +1,325 @@
+#include "worker_pool.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#ifndef WIN32
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+namespace worker_pool
+{
+#ifndef WIN32
+    typedef std::chrono::steady_clock Clock;
+    
+    const int kNoJob = -1;
+    const int kPollIntervalMs = 50;
+    
+    struct Worker
+    {
+        pid_t pid = -1;
+        int job_fd = -1;     // parent -> worker: index of the next input
+        int result_fd = -1;  // worker -> parent: one byte, 1 on success
+        int job = kNoJob;
+        Clock::time_point start;
+    };
+    
+    void worker_main(const std::vector<std::string>& inputs, const JobFunction& job, int job_fd, int result_fd)
+    {
+        uint32_t index;
+        
+        while (read(job_fd, &index, sizeof(index)) == sizeof(index))
+        {
+            uint8_t result = job(inputs[index]) ? 1 : 0;
+            
+            fflush(stdout);
+            fflush(stderr);
+            
+            if (write(result_fd, &result, 1) != 1)
+                break;
+        }
+        
+        _exit(0);
+    }
+    
+    bool spawn_worker(std::vector<Worker>& workers, Worker& worker, const std::vector<std::string>& inputs, const JobFunction& job, const PoolOptions& options)
+    {
+        int job_pipe[2];
+        int result_pipe[2];
+        
+        if (pipe(job_pipe) != 0)
+            return false;
+        
+        if (pipe(result_pipe) != 0)
+        {
+            close(job_pipe[0]);
+            close(job_pipe[1]);
+            return false;
+        }
+        
+        fflush(stdout);
+        fflush(stderr);
+        
+        pid_t pid = fork();
+        
+        if (pid < 0)
+        {
+            close(job_pipe[0]);
+            close(job_pipe[1]);
+            close(result_pipe[0]);
+            close(result_pipe[1]);
+            return false;
+        }
+        
+        if (pid == 0)
+        {
+            close(job_pipe[1]);
+            close(result_pipe[0]);
+            
+            // the other workers only see EOF on their job pipe if the parent holds the last copy
+            for (Worker& other : workers)
+            {
+                if (other.pid > 0)
+                {
+                    close(other.job_fd);
+                    close(other.result_fd);
+                }
+            }
+            
+#ifndef __linux__
+            // no cheap way to watch the resident set size from the parent, so cap the
+            // address space instead
+            if (options.memory_limit > 0)
+            {
+                struct rlimit limit;
+                limit.rlim_cur = rlim_t(options.memory_limit);
+                limit.rlim_max = rlim_t(options.memory_limit);
+                setrlimit(RLIMIT_AS, &limit);
+            }
+#else
+            // the parent enforces the limit from the resident set size instead
+            (void)options;
+#endif
+            
+            worker_main(inputs, job, job_pipe[0], result_pipe[1]);
+        }
+        
+        close(job_pipe[0]);
+        close(result_pipe[1]);
+        
+        worker.pid = pid;
+        worker.job_fd = job_pipe[1];
+        worker.result_fd = result_pipe[0];
+        worker.job = kNoJob;
+        
+        return true;
+    }
+    
+    // Kills the worker if it's still running and reaps it, returning its wait status.
+    int kill_worker(Worker& worker, bool force)
+    {
+        int status = 0;
+        
+        if (force)
+            kill(worker.pid, SIGKILL);
+        
+        close(worker.job_fd);
+        close(worker.result_fd);
+        
+        while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR)
+            ;
+        
+        worker.pid = -1;
+        
+        return status;
+    }
+    
+    uint64_t resident_set_size(pid_t pid)
+    {
+#ifdef __linux__
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/statm", int(pid));
+        
+        FILE* file = fopen(path, "r");
+        
+        if (!file)
+            return 0;
+        
+        unsigned long long size = 0;
+        unsigned long long resident = 0;
+        
+        if (fscanf(file, "%llu %llu", &size, &resident) != 2)
+            resident = 0;
+        
+        fclose(file);
+        
+        return uint64_t(resident) * uint64_t(sysconf(_SC_PAGESIZE));
+#else
+        return 0;
+#endif
+    }
+    
+    void finish_job(Worker& worker, JobStatus status, int code, Clock::time_point pool_start, std::vector<JobReport>& reports)
+    {
+        JobReport& report = reports[worker.job];
+        report.status = status;
+        report.code = code;
+        report.seconds = std::chrono::duration<double>(Clock::now() - worker.start).count();
+        report.start = std::chrono::duration<double>(worker.start - pool_start).count();
+        worker.job = kNoJob;
+    }
+    
+    bool run(const std::vector<std::string>& inputs, const JobFunction& job, const PoolOptions& options, std::vector<JobReport>& reports)
+    {
+        uint32_t worker_count = options.worker_count > 0 ? options.worker_count : std::max(1u, std::thread::hardware_concurrency());
+        
+        if (worker_count > inputs.size())
+            worker_count = uint32_t(inputs.size());
+        
+        reports.resize(inputs.size());
+        
+        for (size_t i = 0; i < inputs.size(); i++)
+            reports[i] = { inputs[i], JOB_STATUS_FAILED, 0, 0.0, 0.0, 0 };
+        
+        // a worker dying between jobs must not take the parent down with it
+        void (*previous_handler)(int) = signal(SIGPIPE, SIG_IGN);
+        
+        std::vector<Worker> workers(worker_count);
+        Clock::time_point pool_start = Clock::now();
+        
+        for (Worker& worker : workers)
+        {
+            if (!spawn_worker(workers, worker, inputs, job, options))
+            {
+                printf("ERROR: Failed to start worker process!\n");
+                
+                for (Worker& started : workers)
+                {
+                    if (started.pid > 0)
+                        kill_worker(started, true);
+                }
+                
+                signal(SIGPIPE, previous_handler);
+                return false;
+            }
+        }
+        
+        size_t next_input = 0;
+        size_t completed = 0;
+        bool success = true;
+        
+        while (completed < inputs.size() && success)
+        {
+            std::vector<pollfd> fds;
+            std::vector<Worker*> busy;
+            
+            for (Worker& worker : workers)
+            {
+                if (worker.job == kNoJob && next_input < inputs.size())
+                {
+                    uint32_t index = uint32_t(next_input);
+                    
+                    if (write(worker.job_fd, &index, sizeof(index)) == sizeof(index))
+                    {
+                        worker.job = int(next_input++);
+                        worker.start = Clock::now();
+                        reports[worker.job].worker = uint32_t(&worker - &workers[0]);
+                    }
+                    else
+                    {
+                        // died while idle, restart it and hand the input to the next one
+                        kill_worker(worker, true);
+                        
+                        if (!spawn_worker(workers, worker, inputs, job, options))
+                            success = false;
+                        
+                        continue;
+                    }
+                }
+                
+                if (worker.job != kNoJob)
+                {
+                    fds.push_back({ worker.result_fd, POLLIN, 0 });
+                    busy.push_back(&worker);
+                }
+            }
+            
+            if (fds.empty())
+                continue;
+            
+            if (poll(fds.data(), fds.size(), kPollIntervalMs) < 0 && errno != EINTR)
+            {
+                success = false;
+                break;
+            }
+            
+            for (size_t i = 0; i < busy.size(); i++)
+            {
+                Worker& worker = *busy[i];
+                bool restart = false;
+                
+                if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+                {
+                    uint8_t result;
+                    
+                    if (read(worker.result_fd, &result, 1) == 1)
+                        finish_job(worker, result ? JOB_STATUS_SUCCEEDED : JOB_STATUS_FAILED, 0, pool_start, reports);
+                    else
+                    {
+                        int status = kill_worker(worker, false);
+                        int code = WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status);
+                        finish_job(worker, JOB_STATUS_CRASHED, code, pool_start, reports);
+                        restart = true;
+                    }
+                    
+                    completed++;
+                }
+                else if (options.timeout_ms > 0 && Clock::now() - worker.start > std::chrono::milliseconds(options.timeout_ms))
+                {
+                    kill_worker(worker, true);
+                    finish_job(worker, JOB_STATUS_TIMED_OUT, SIGKILL, pool_start, reports);
+                    completed++;
+                    restart = true;
+                }
+                else if (options.memory_limit > 0 && resident_set_size(worker.pid) > options.memory_limit)
+                {
+                    kill_worker(worker, true);
+                    finish_job(worker, JOB_STATUS_OUT_OF_MEMORY, SIGKILL, pool_start, reports);
+                    completed++;
+                    restart = true;
+                }
+                
+                if (restart && (completed < inputs.size()) && !spawn_worker(workers, worker, inputs, job, options))
+                {
+                    printf("ERROR: Failed to restart worker process!\n");
+                    success = false;
+                }
+            }
+        }
+        
+        // workers exit once their job pipe is closed
+        for (Worker& worker : workers)
+        {
+            if (worker.pid > 0)
+                kill_worker(worker, !success);
+        }
+        
+        signal(SIGPIPE, previous_handler);
+        
+        return success;
+    }
+#else
+    bool run(const std::vector<std::string>& inputs, const JobFunction& job, const PoolOptions& options, std::vector<JobReport>& reports)
+    {
+        printf("ERROR: Worker processes are not supported on Windows!\n");
+        return false;
+    }
+#endif
+}
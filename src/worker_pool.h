@@ -0,0 +1,44 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace worker_pool
+{
+    enum JobStatus
+    {
+        JOB_STATUS_SUCCEEDED,
+        JOB_STATUS_FAILED,
+        JOB_STATUS_CRASHED,
+        JOB_STATUS_TIMED_OUT,
+        JOB_STATUS_OUT_OF_MEMORY
+    };
+    
+    struct PoolOptions
+    {
+        uint32_t worker_count = 0;   // 0 uses one worker per hardware thread
+        uint32_t timeout_ms = 0;     // wall-clock limit per job, 0 disables it
+        uint64_t memory_limit = 0;   // resident set size limit per worker in bytes, 0 disables it
+    };
+    
+    struct JobReport
+    {
+        std::string input;
+        JobStatus status;
+        int code;        // exit code or signal of crashed workers
+        double seconds;
+        double start;    // seconds since the pool started
+        uint32_t worker;
+    };
+    
+    // Runs in a worker process and returns whether the input compiled successfully.
+    typedef std::function<bool(const std::string& input)> JobFunction;
+    
+    // Runs 'job' for every input in a pool of forked worker processes connected by pipes.
+    // Workers that crash, hang past the timeout or exceed the memory limit are killed and
+    // replaced, and the job they were running is reported as failed. Inputs are handed out
+    // in order, and 'reports' is in the same order as 'inputs'. Not supported on Windows.
+    extern bool run(const std::vector<std::string>& inputs, const JobFunction& job, const PoolOptions& options, std::vector<JobReport>& reports);
+}
@@ -0,0 +1,72 @@
+#include "compile_queue.h"
+
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <string>
+#include <vector>
+
+// One worker compiles Vulkan and OpenGL GLSL jobs in turn. Each module has to target the
+// SPIR-V version of its own job, not the one of the first job the worker ran.
+int main()
+{
+    const char* kShaderPath = "compile_queue_test.vert";
+    
+    std::ofstream shader(kShaderPath);
+    shader << "#version 450\n"
+              "layout(location = 0) in vec4 position;\n"
+              "void main() { gl_Position = position; }\n";
+    shader.close();
+    
+    if (!compile_queue::start(1))
+    {
+        printf("FAILED: compile queue didn't start\n");
+        return 1;
+    }
+    
+    const bool kVulkanGlsl[] = { true, false, false, true, true, false };
+    const size_t kJobCount = sizeof(kVulkanGlsl) / sizeof(kVulkanGlsl[0]);
+    
+    std::vector<std::future<compile_queue::CompileResult>> results(kJobCount);
+    
+    for (size_t i = 0; i < kJobCount; i++)
+    {
+        compile_queue::CompileRequest request;
+        request.path = kShaderPath;
+        request.stage = spirv_compiler::SHADER_STAGE_VERTEX;
+        request.lang = cross_compiler::SHADING_LANGUAGE_GLSL_450;
+        request.vulkan_glsl = kVulkanGlsl[i];
+        
+        compile_queue::submit(request, results[i]);
+    }
+    
+    int failures = 0;
+    
+    for (size_t i = 0; i < kJobCount; i++)
+    {
+        compile_queue::CompileResult result = results[i].get();
+        
+        // Vulkan 1.1 targets SPIR-V 1.3, OpenGL 4.5 targets SPIR-V 1.0
+        unsigned int expected_version = kVulkanGlsl[i] ? 0x00010300u : 0x00010000u;
+        
+        if (result.status != compile_queue::JOB_STATUS_SUCCEEDED || result.spirv.size() < 5)
+        {
+            printf("FAILED: job %u didn't compile\n", unsigned(i));
+            failures++;
+        }
+        else if (result.spirv[1] != expected_version)
+        {
+            printf("FAILED: job %u (%s) targets SPIR-V 0x%08x, expected 0x%08x\n", unsigned(i),
+                   kVulkanGlsl[i] ? "Vulkan" : "OpenGL", result.spirv[1], expected_version);
+            failures++;
+        }
+    }
+    
+    compile_queue::stop();
+    std::remove(kShaderPath);
+    
+    if (failures == 0)
+        printf("compile_queue_test passed\n");
+    
+    return failures == 0 ? 0 : 1;
+}